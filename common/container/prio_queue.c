@@ -0,0 +1,275 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdlib.h>
+#include "prio_queue.h"
+
+int prio_queue_init(prio_queue_t *queue, int max, int guard)
+{
+	if(!queue || max == 0)
+		return -1;
+
+	queue->max = max;
+	queue->guard = guard;
+	queue->len = 0;
+	queue->is_close = 0;
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->push_cond, NULL);
+	pthread_cond_init(&queue->pop_cond, NULL);
+	for(int i = 0; i < PRIO_QUEUE_LANE; i++)
+	{
+		queue->lane_len[i] = 0;
+		queue->skip[i] = 0;
+		INIT_LIST_HEAD(&queue->node[i]);
+	}
+
+	return 1;
+}
+
+int prio_queue_exit(prio_queue_t *queue)
+{
+	if(!queue)
+		return -1;
+
+	for(int i = 0; i < PRIO_QUEUE_LANE; i++)
+		INIT_LIST_HEAD(&queue->node[i]);
+	pthread_cond_destroy(&queue->pop_cond);
+	pthread_cond_destroy(&queue->push_cond);
+	pthread_mutex_destroy(&queue->mutex);
+
+	return 1;
+}
+
+prio_queue_t *prio_queue_create(int max, int guard)
+{
+	prio_queue_t *queue = (prio_queue_t *)calloc(1, sizeof(prio_queue_t));
+	if(!queue)
+		return NULL;
+
+	int ret = prio_queue_init(queue, max, guard);
+	if(ret != 1)
+	{
+		free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+int prio_queue_destroy(prio_queue_t *queue)
+{
+	if(!queue)
+		return -1;
+
+	prio_queue_exit(queue);
+	free(queue);
+
+	return 1;
+}
+
+static int prio_queue_push2(prio_queue_t *queue, struct list_head *node, int lane, char is_block)
+{
+	if(!queue || !node)
+		return -1;
+
+	if(lane < 0)
+		lane = 0;
+	else if(lane >= PRIO_QUEUE_LANE)
+		lane = PRIO_QUEUE_LANE - 1;
+
+	pthread_mutex_lock(&queue->mutex);
+	if(queue->max != -1)
+	{
+		while(queue->lane_len[lane] > queue->max - 1 && !queue->is_close)
+		{
+			if(!is_block)
+			{
+				pthread_mutex_unlock(&queue->mutex);
+				return 0;
+			}
+
+			pthread_cond_wait(&queue->push_cond, &queue->mutex);
+		}
+	}
+	if(queue->is_close)
+	{
+		pthread_mutex_unlock(&queue->mutex);
+		return -1;
+	}
+	queue->len++;
+	queue->lane_len[lane]++;
+	list_add_tail(node, &queue->node[lane]);
+	pthread_mutex_unlock(&queue->mutex);
+	pthread_cond_signal(&queue->pop_cond);
+
+	return 1;
+}
+
+int prio_queue_push(prio_queue_t *queue, struct list_head *node, int lane)
+{
+	return prio_queue_push2(queue, node, lane, 1);
+}
+
+int prio_queue_try_push(prio_queue_t *queue, struct list_head *node, int lane)
+{
+	return prio_queue_push2(queue, node, lane, 0);
+}
+
+int prio_queue_push_list(prio_queue_t *queue, struct list_head *list, int lane)
+{
+	if(!queue || !list)
+		return -1;
+
+	if(lane < 0)
+		lane = 0;
+	else if(lane >= PRIO_QUEUE_LANE)
+		lane = PRIO_QUEUE_LANE - 1;
+
+	int num = 0;
+
+	pthread_mutex_lock(&queue->mutex);
+	while(!list_empty(list))
+	{
+		while(queue->max != -1 && queue->lane_len[lane] > queue->max - 1 && !queue->is_close)
+		{
+			pthread_cond_signal(&queue->pop_cond);
+			pthread_cond_wait(&queue->push_cond, &queue->mutex);
+		}
+		if(queue->is_close)
+			break;
+
+		list_move_tail(list->next, &queue->node[lane]);
+		queue->len++;
+		queue->lane_len[lane]++;
+		num++;
+	}
+	pthread_mutex_unlock(&queue->mutex);
+	if(num > 0)
+		pthread_cond_signal(&queue->pop_cond);
+
+	return num;
+}
+
+int prio_queue_replace(prio_queue_t *queue, struct list_head *old, struct list_head *node)
+{
+	if(!queue || !old || !node)
+		return -1;
+
+	pthread_mutex_lock(&queue->mutex);
+	if(list_empty(old))
+	{
+		pthread_mutex_unlock(&queue->mutex);
+		return 0;
+	}
+
+	list_replace_init(old, node);
+	pthread_mutex_unlock(&queue->mutex);
+
+	return 1;
+}
+
+/* a closed queue stops handing out nodes at its deadline, the owner frees the rest with prio_queue_try_pop */
+static int prio_queue_is_drained(prio_queue_t *queue)
+{
+	if(!queue->is_close)
+		return 0;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec > queue->deadline.tv_sec || (now.tv_sec == queue->deadline.tv_sec && now.tv_nsec >= queue->deadline.tv_nsec);
+}
+
+static struct list_head *prio_queue_pop2(prio_queue_t *queue, char is_block)
+{
+	if(!queue)
+		return NULL;
+
+	pthread_mutex_lock(&queue->mutex);
+	if(is_block && prio_queue_is_drained(queue))
+	{
+		pthread_mutex_unlock(&queue->mutex);
+		return NULL;
+	}
+	while(queue->len == 0)
+	{
+		if(!is_block || queue->is_close)
+		{
+			pthread_mutex_unlock(&queue->mutex);
+			return NULL;
+		}
+
+		pthread_cond_wait(&queue->pop_cond, &queue->mutex);
+	}
+
+	int lane = PRIO_QUEUE_LANE - 1;
+	while(queue->lane_len[lane] == 0)
+		lane--;
+
+	int lane2 = lane;
+	for(int i = 0; i < lane; i++)
+	{
+		if(queue->lane_len[i] == 0)
+			continue;
+
+		queue->skip[i]++;
+		if(queue->guard != -1 && queue->skip[i] > queue->guard && lane2 == lane)
+			lane2 = i;
+	}
+	queue->skip[lane2] = 0;
+
+	char is_full = queue->max != -1 && queue->lane_len[lane2] > queue->max - 1;
+
+	struct list_head *node = queue->node[lane2].next;
+	list_del_init(node);
+	queue->len--;
+	queue->lane_len[lane2]--;
+	pthread_mutex_unlock(&queue->mutex);
+	if(is_full)
+		pthread_cond_broadcast(&queue->push_cond);
+
+	return node;
+}
+
+struct list_head *prio_queue_pop(prio_queue_t *queue)
+{
+	return prio_queue_pop2(queue, 1);
+}
+
+struct list_head *prio_queue_try_pop(prio_queue_t *queue)
+{
+	return prio_queue_pop2(queue, 0);
+}
+
+int prio_queue_close(prio_queue_t *queue, int drain)
+{
+	if(!queue)
+		return -1;
+
+	pthread_mutex_lock(&queue->mutex);
+	clock_gettime(CLOCK_MONOTONIC, &queue->deadline);
+	queue->deadline.tv_sec += drain / 1000;
+	queue->deadline.tv_nsec += (drain % 1000) * 1000000;
+	if(queue->deadline.tv_nsec >= 1000000000)
+	{
+		queue->deadline.tv_sec++;
+		queue->deadline.tv_nsec -= 1000000000;
+	}
+	queue->is_close = 1;
+	pthread_mutex_unlock(&queue->mutex);
+	pthread_cond_broadcast(&queue->pop_cond);
+	pthread_cond_broadcast(&queue->push_cond);
+
+	return 1;
+}
+
+int prio_queue_open(prio_queue_t *queue)
+{
+	if(!queue)
+		return -1;
+
+	pthread_mutex_lock(&queue->mutex);
+	queue->is_close = 0;
+	pthread_mutex_unlock(&queue->mutex);
+
+	return 1;
+}
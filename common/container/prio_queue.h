@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef _PRIO_QUEUE_H_
+#define _PRIO_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <pthread.h>
+#include <time.h>
+#include "list.h"
+
+#define PRIO_QUEUE_LANE 4
+
+/*
+ * Blocking queue with PRIO_QUEUE_LANE lanes, the highest non-empty lane is popped first.
+ * max bounds every lane on its own, so a full low lane never blocks a push to a higher one.
+ * A non-empty lane that has been passed over guard times is served next (guard -1 disables it).
+ */
+typedef struct
+{
+	int max;
+	int guard;
+	int len;
+	int lane_len[PRIO_QUEUE_LANE];
+	int skip[PRIO_QUEUE_LANE];
+	pthread_mutex_t mutex;
+	pthread_cond_t push_cond;
+	pthread_cond_t pop_cond;
+	char is_close;
+	struct timespec deadline;
+	struct list_head node[PRIO_QUEUE_LANE];
+} prio_queue_t;
+
+int prio_queue_init(prio_queue_t *queue, int max, int guard);
+
+int prio_queue_exit(prio_queue_t *queue);
+
+prio_queue_t *prio_queue_create(int max, int guard);
+
+int prio_queue_destroy(prio_queue_t *queue);
+
+int prio_queue_push(prio_queue_t *queue, struct list_head *node, int lane);
+
+/* returns 0 instead of waiting when the lane is full, pushes fail with -1 once the queue is closed */
+int prio_queue_try_push(prio_queue_t *queue, struct list_head *node, int lane);
+
+/* moves every node of list to lane with one lock and one wakeup, waiting while the lane is full, returns the number moved */
+int prio_queue_push_list(prio_queue_t *queue, struct list_head *list, int lane);
+
+/* puts node in the place of old when old is still queued, returns 0 when it is not */
+int prio_queue_replace(prio_queue_t *queue, struct list_head *old, struct list_head *node);
+
+/*
+ * popped nodes are left empty, so list_empty tells whether a node is still queued.
+ * Returns NULL once the queue is closed and empty, or drain ms after closing.
+ */
+struct list_head *prio_queue_pop(prio_queue_t *queue);
+
+/* returns NULL instead of waiting when the queue is empty, also after the drain time */
+struct list_head *prio_queue_try_pop(prio_queue_t *queue);
+
+/* wakes every waiting push and pop, what is still queued can be popped for drain ms */
+int prio_queue_close(prio_queue_t *queue, int drain);
+
+int prio_queue_open(prio_queue_t *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,6 +3,30 @@
 #include <stdlib.h>
 #include "queue.h"
 
+static void queue_set_deadline(queue_t *queue, int drain)
+{
+	clock_gettime(CLOCK_MONOTONIC, &queue->deadline);
+	queue->deadline.tv_sec += drain / 1000;
+	queue->deadline.tv_nsec += (drain % 1000) * 1000000;
+	if(queue->deadline.tv_nsec >= 1000000000)
+	{
+		queue->deadline.tv_sec++;
+		queue->deadline.tv_nsec -= 1000000000;
+	}
+}
+
+/* a closed queue stops handing out nodes at its deadline, the owner frees the rest with queue_try_pop */
+static int queue_is_drained(queue_t *queue)
+{
+	if(!__atomic_load_n(&queue->is_close, __ATOMIC_ACQUIRE))
+		return 0;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec > queue->deadline.tv_sec || (now.tv_sec == queue->deadline.tv_sec && now.tv_nsec >= queue->deadline.tv_nsec);
+}
+
 #if defined(BASIC_QUEUE)
 
 int queue_init(queue_t *queue, int max)
@@ -12,6 +36,7 @@ int queue_init(queue_t *queue, int max)
 	
 	queue->max = max;
     queue->len = 0;
+	queue->is_close = 0;
     pthread_mutex_init(&queue->mutex, NULL);
 	pthread_cond_init(&queue->push_cond, NULL);
 	pthread_cond_init(&queue->pop_cond, NULL);
@@ -40,8 +65,13 @@ int queue_push(queue_t *queue, struct list_head *node)
 
     pthread_mutex_lock(&queue->mutex);
 	if(queue->max != -1)
-		while(queue->len > queue->max - 1)
+		while(queue->len > queue->max - 1 && !queue->is_close)
 			pthread_cond_wait(&queue->push_cond, &queue->mutex);
+	if(queue->is_close)
+	{
+		pthread_mutex_unlock(&queue->mutex);
+		return -1;
+	}
 	queue->len++;
 	list_add_tail(node, &queue->node);
 	pthread_mutex_unlock(&queue->mutex);
@@ -50,7 +80,31 @@ int queue_push(queue_t *queue, struct list_head *node)
     return 1;
 }
 
-struct list_head *queue_pop(queue_t *queue)
+int queue_try_push(queue_t *queue, struct list_head *node)
+{
+	if(!queue || !node)
+        return -1;
+
+    pthread_mutex_lock(&queue->mutex);
+	if(queue->is_close)
+	{
+		pthread_mutex_unlock(&queue->mutex);
+		return -1;
+	}
+	if(queue->max != -1 && queue->len > queue->max - 1)
+	{
+		pthread_mutex_unlock(&queue->mutex);
+		return 0;
+	}
+	queue->len++;
+	list_add_tail(node, &queue->node);
+	pthread_mutex_unlock(&queue->mutex);
+	pthread_cond_signal(&queue->pop_cond);
+	
+    return 1;
+}
+
+static struct list_head *queue_pop2(queue_t *queue, char is_block)
 {
 	if(!queue)
 		return NULL;
@@ -58,7 +112,15 @@ struct list_head *queue_pop(queue_t *queue)
 	struct list_head *node = NULL;
     pthread_mutex_lock(&queue->mutex);
 	while(queue->len == 0)
+	{
+		if(!is_block || queue->is_close)
+		{
+			pthread_mutex_unlock(&queue->mutex);
+			return NULL;
+		}
+
 		pthread_cond_wait(&queue->pop_cond, &queue->mutex);
+	}
 	queue->len--;
 	node = queue->node.next;
 	list_del(node);
@@ -69,6 +131,46 @@ struct list_head *queue_pop(queue_t *queue)
 	return node;
 }
 
+struct list_head *queue_pop(queue_t *queue)
+{
+	if(queue_is_drained(queue))
+		return NULL;
+
+	return queue_pop2(queue, 1);
+}
+
+struct list_head *queue_try_pop(queue_t *queue)
+{
+	return queue_pop2(queue, 0);
+}
+
+int queue_close(queue_t *queue, int drain)
+{
+	if(!queue)
+		return -1;
+
+	pthread_mutex_lock(&queue->mutex);
+	queue_set_deadline(queue, drain);
+	__atomic_store_n(&queue->is_close, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&queue->mutex);
+	pthread_cond_broadcast(&queue->pop_cond);
+	pthread_cond_broadcast(&queue->push_cond);
+
+	return 1;
+}
+
+int queue_open(queue_t *queue)
+{
+	if(!queue)
+		return -1;
+
+	pthread_mutex_lock(&queue->mutex);
+	__atomic_store_n(&queue->is_close, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&queue->mutex);
+
+	return 1;
+}
+
 #elif defined(DOUBLE_LIST_QUEUE)
 
 int queue_init(queue_t *queue, int max)
@@ -78,6 +180,7 @@ int queue_init(queue_t *queue, int max)
 	
 	queue->max = max;
 	queue->len = 0;
+	queue->is_close = 0;
     pthread_mutex_init(&queue->push_mutex, NULL);
 	pthread_mutex_init(&queue->pop_mutex, NULL);
 	pthread_cond_init(&queue->push_cond, NULL);
@@ -99,7 +202,6 @@ int queue_exit(queue_t *queue)
 	pthread_cond_destroy(&queue->push_cond);
     pthread_mutex_destroy(&queue->pop_mutex);
 	pthread_mutex_destroy(&queue->push_mutex);
-	free(queue);
 	
     return 1;
 }
@@ -111,8 +213,13 @@ int queue_push(queue_t *queue, struct list_head *node)
 	
     pthread_mutex_lock(&queue->push_mutex);
 	if(queue->max != -1)
-		while(queue->len > queue->max - 1)
+		while(queue->len > queue->max - 1 && !queue->is_close)
 			pthread_cond_wait(&queue->push_cond, &queue->push_mutex);
+	if(queue->is_close)
+	{
+		pthread_mutex_unlock(&queue->push_mutex);
+		return -1;
+	}
 	queue->len++;
 	list_add_tail(node, &queue->push_node);
 	pthread_mutex_unlock(&queue->push_mutex);
@@ -121,14 +228,46 @@ int queue_push(queue_t *queue, struct list_head *node)
     return 1;
 }
 
-static int swap_list(queue_t *queue)
+int queue_try_push(queue_t *queue, struct list_head *node)
+{
+	if(!queue || !node)
+        return -1;
+	
+    pthread_mutex_lock(&queue->push_mutex);
+	if(queue->is_close)
+	{
+		pthread_mutex_unlock(&queue->push_mutex);
+		return -1;
+	}
+	if(queue->max != -1 && queue->len > queue->max - 1)
+	{
+		pthread_mutex_unlock(&queue->push_mutex);
+		return 0;
+	}
+	queue->len++;
+	list_add_tail(node, &queue->push_node);
+	pthread_mutex_unlock(&queue->push_mutex);
+	pthread_cond_signal(&queue->pop_cond);
+
+    return 1;
+}
+
+static int swap_list(queue_t *queue, char is_block)
 {
 	if(!queue)
 		return -1;
 	
 	pthread_mutex_lock(&queue->push_mutex);
 	while(queue->len == 0)
+	{
+		if(!is_block || queue->is_close)
+		{
+			pthread_mutex_unlock(&queue->push_mutex);
+			return 0;
+		}
+
 		pthread_cond_wait(&queue->pop_cond, &queue->push_mutex);
+	}
 
 	int len = queue->len;
 	if(queue->max != -1)
@@ -143,14 +282,14 @@ static int swap_list(queue_t *queue)
 	return len;
 }
 
-struct list_head *queue_pop(queue_t *queue)
+static struct list_head *queue_pop2(queue_t *queue, char is_block)
 {
 	if(!queue)
 		return NULL;
 	
 	struct list_head *node = NULL;
     pthread_mutex_lock(&queue->pop_mutex);
-	if(!list_empty(&queue->pop_node) || swap_list(queue) > 0)
+	if(!list_empty(&queue->pop_node) || swap_list(queue, is_block) > 0)
 	{
 		node = queue->pop_node.next;
 		list_del(node);
@@ -160,6 +299,46 @@ struct list_head *queue_pop(queue_t *queue)
 	return node;
 }
 
+struct list_head *queue_pop(queue_t *queue)
+{
+	if(queue_is_drained(queue))
+		return NULL;
+
+	return queue_pop2(queue, 1);
+}
+
+struct list_head *queue_try_pop(queue_t *queue)
+{
+	return queue_pop2(queue, 0);
+}
+
+int queue_close(queue_t *queue, int drain)
+{
+	if(!queue)
+		return -1;
+
+	pthread_mutex_lock(&queue->push_mutex);
+	queue_set_deadline(queue, drain);
+	__atomic_store_n(&queue->is_close, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&queue->push_mutex);
+	pthread_cond_broadcast(&queue->pop_cond);
+	pthread_cond_broadcast(&queue->push_cond);
+
+	return 1;
+}
+
+int queue_open(queue_t *queue)
+{
+	if(!queue)
+		return -1;
+
+	pthread_mutex_lock(&queue->push_mutex);
+	__atomic_store_n(&queue->is_close, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&queue->push_mutex);
+
+	return 1;
+}
+
 #endif
 
 queue_t *queue_create(int max)
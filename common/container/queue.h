@@ -9,6 +9,7 @@ extern "C"
 #endif
 
 #include <pthread.h>
+#include <time.h>
 #include "list.h"
 
 #if defined(BASIC_QUEUE)
@@ -20,6 +21,8 @@ typedef struct
 	pthread_mutex_t mutex;
 	pthread_cond_t push_cond;
 	pthread_cond_t pop_cond;
+	char is_close;
+	struct timespec deadline;
 	struct list_head node;
 } queue_t;
 
@@ -33,6 +36,8 @@ typedef struct
 	pthread_mutex_t pop_mutex;
 	pthread_cond_t push_cond;
 	pthread_cond_t pop_cond;
+	char is_close;
+	struct timespec deadline;
 	struct list_head push_node;
 	struct list_head pop_node;
 } queue_t;
@@ -49,8 +54,20 @@ int queue_destroy(queue_t *queue);
 
 int queue_push(queue_t *queue, struct list_head *node);
 
+/* returns 0 instead of waiting when the queue is full, pushes fail with -1 once the queue is closed */
+int queue_try_push(queue_t *queue, struct list_head *node);
+
+/* returns NULL once the queue is closed and empty, or drain ms after closing */
 struct list_head *queue_pop(queue_t *queue);
 
+/* returns NULL instead of waiting when the queue is empty, also after the drain time */
+struct list_head *queue_try_pop(queue_t *queue);
+
+/* wakes every waiting push and pop, what is still queued can be popped for drain ms */
+int queue_close(queue_t *queue, int drain);
+
+int queue_open(queue_t *queue);
+
 #ifdef __cplusplus
 }
 #endif
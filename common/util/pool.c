@@ -0,0 +1,278 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "pool.h"
+
+typedef struct
+{
+	int index;
+} pool_head_t;
+
+typedef struct pool_magazine
+{
+	int len;
+	struct pool_magazine *next;
+	void *obj[POOL_MAGAZINE_LEN];
+} pool_magazine_t;
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pool_magazine_t *full;
+	pool_magazine_t *empty;
+	int full_len;
+	pool_stat_t stat;
+} pool_depot_t;
+
+typedef struct
+{
+	char is_register;
+	pool_magazine_t *magazine[POOL_CLASS_LEN];
+} pool_cache_t;
+
+static pool_depot_t pool_depot[POOL_CLASS_LEN];
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+static __thread pool_cache_t pool_cache;
+
+static void pool_key_destructor(void *para)
+{
+	pool_flush();
+}
+
+/* POOL_CLASS_STEP classes evenly spaced between two powers of two, all multiples of POOL_ALIGN */
+static inline size_t pool_get_size(int index)
+{
+	size_t size = (size_t)POOL_CLASS_MIN << (index / POOL_CLASS_STEP);
+
+	return size + (index % POOL_CLASS_STEP) * (size / POOL_CLASS_STEP);
+}
+
+static void pool_init(void)
+{
+	for(int i = 0; i < POOL_CLASS_LEN; i++)
+	{
+		pthread_mutex_init(&pool_depot[i].mutex, NULL);
+		pool_depot[i].stat.size = pool_get_size(i);
+	}
+
+	pthread_key_create(&pool_key, pool_key_destructor);
+}
+
+static inline int pool_get_index(size_t size)
+{
+	if(size <= POOL_CLASS_MIN)
+		return 0;
+
+	/* the highest bit of size - 1 picks the doubling, the bits below it the step */
+	int bit = (int)(sizeof(unsigned long) * 8) - 1 - __builtin_clzl(size - 1);
+	int step = ((size - 1) >> (bit - __builtin_ctz(POOL_CLASS_STEP))) & (POOL_CLASS_STEP - 1);
+	int index = (bit - __builtin_ctz(POOL_CLASS_MIN)) * POOL_CLASS_STEP + step + 1;
+	if(index >= POOL_CLASS_LEN)
+		return -1;
+
+	return index;
+}
+
+static inline int pool_get_magazine_len(int index)
+{
+	int len = POOL_MAGAZINE_SIZE / pool_get_size(index);
+	if(len < 4)
+		len = 4;
+	if(len > POOL_MAGAZINE_LEN)
+		len = POOL_MAGAZINE_LEN;
+
+	return len;
+}
+
+static void pool_register(void)
+{
+	pthread_once(&pool_once, pool_init);
+	pthread_setspecific(pool_key, &pool_cache);
+	pool_cache.is_register = 1;
+}
+
+static void pool_release(int index, pool_magazine_t *magazine)
+{
+	__atomic_add_fetch(&pool_depot[index].stat.release, magazine->len, __ATOMIC_RELAXED);
+
+	for(int i = 0; i < magazine->len; i++)
+		free(magazine->obj[i]);
+	magazine->len = 0;
+}
+
+/* swaps the empty magazine of the calling thread for a full one from the depot */
+static pool_magazine_t *pool_refill(int index)
+{
+	pool_depot_t *depot = &pool_depot[index];
+	pool_magazine_t *magazine = pool_cache.magazine[index];
+
+	pthread_mutex_lock(&depot->mutex);
+
+	pool_magazine_t *full = depot->full;
+	if(full)
+	{
+		depot->full = full->next;
+		depot->full_len--;
+		depot->stat.refill++;
+		depot->stat.depot = depot->full_len;
+
+		if(magazine)
+		{
+			magazine->next = depot->empty;
+			depot->empty = magazine;
+		}
+		magazine = full;
+	}
+
+	pthread_mutex_unlock(&depot->mutex);
+
+	pool_cache.magazine[index] = magazine;
+
+	return full;
+}
+
+/* hands the full magazine of the calling thread to the depot and takes an empty one */
+static pool_magazine_t *pool_exchange(int index)
+{
+	pool_depot_t *depot = &pool_depot[index];
+	pool_magazine_t *magazine = pool_cache.magazine[index];
+	pool_magazine_t *empty = NULL;
+
+	pthread_mutex_lock(&depot->mutex);
+
+	if(magazine && depot->full_len >= POOL_DEPOT_MAX)
+	{
+		pthread_mutex_unlock(&depot->mutex);
+		pool_release(index, magazine);
+		return magazine;
+	}
+
+	if(magazine)
+	{
+		magazine->next = depot->full;
+		depot->full = magazine;
+		depot->full_len++;
+		depot->stat.flush++;
+		depot->stat.depot = depot->full_len;
+	}
+
+	empty = depot->empty;
+	if(empty)
+		depot->empty = empty->next;
+
+	pthread_mutex_unlock(&depot->mutex);
+
+	if(!empty)
+		empty = (pool_magazine_t *)malloc(sizeof(pool_magazine_t));
+	if(empty)
+		empty->len = 0;
+
+	pool_cache.magazine[index] = empty;
+
+	return empty;
+}
+
+void *pool_alloc(size_t size)
+{
+	if(!pool_cache.is_register)
+		pool_register();
+
+	int index = pool_get_index(size + POOL_ALIGN);
+	if(index != -1)
+	{
+		pool_magazine_t *magazine = pool_cache.magazine[index];
+		if((magazine && magazine->len > 0) || (magazine = pool_refill(index)))
+			return (char *)magazine->obj[--magazine->len] + POOL_ALIGN;
+	}
+
+	size_t size2 = index != -1 ? pool_get_size(index) : size + POOL_ALIGN;
+	pool_head_t *head = (pool_head_t *)posix_memalign2(POOL_ALIGN, size2);
+	if(!head)
+		return NULL;
+
+	head->index = index;
+	if(index != -1)
+		__atomic_add_fetch(&pool_depot[index].stat.miss, 1, __ATOMIC_RELAXED);
+
+	return (char *)head + POOL_ALIGN;
+}
+
+void pool_free(void *p)
+{
+	if(!p)
+		return;
+
+	pool_head_t *head = (pool_head_t *)((char *)p - POOL_ALIGN);
+	int index = head->index;
+	if(index == -1)
+	{
+		free(head);
+		return;
+	}
+
+	if(!pool_cache.is_register)
+		pool_register();
+
+	pool_magazine_t *magazine = pool_cache.magazine[index];
+	if(!magazine || magazine->len >= pool_get_magazine_len(index))
+		magazine = pool_exchange(index);
+
+	if(!magazine)
+	{
+		free(head);
+		return;
+	}
+
+	magazine->obj[magazine->len++] = head;
+}
+
+void pool_flush(void)
+{
+	if(!pool_cache.is_register)
+		return;
+
+	for(int i = 0; i < POOL_CLASS_LEN; i++)
+	{
+		pool_magazine_t *magazine = pool_cache.magazine[i];
+		if(!magazine)
+			continue;
+
+		pool_cache.magazine[i] = NULL;
+
+		pool_depot_t *depot = &pool_depot[i];
+		pthread_mutex_lock(&depot->mutex);
+		if(magazine->len > 0 && depot->full_len < POOL_DEPOT_MAX)
+		{
+			magazine->next = depot->full;
+			depot->full = magazine;
+			depot->full_len++;
+			depot->stat.flush++;
+			depot->stat.depot = depot->full_len;
+			magazine = NULL;
+		}
+		pthread_mutex_unlock(&depot->mutex);
+
+		if(magazine)
+		{
+			pool_release(i, magazine);
+			free(magazine);
+		}
+	}
+}
+
+int pool_get_stat(int index, pool_stat_t *stat)
+{
+	if(index < 0 || index >= POOL_CLASS_LEN || !stat)
+		return -1;
+
+	pthread_once(&pool_once, pool_init);
+
+	pthread_mutex_lock(&pool_depot[index].mutex);
+	*stat = pool_depot[index].stat;
+	pthread_mutex_unlock(&pool_depot[index].mutex);
+
+	return 1;
+}
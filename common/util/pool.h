@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdlib.h>
+
+/*
+ * Size-class allocator: every thread keeps a magazine of free objects per class,
+ * full and empty magazines are exchanged with a shared depot, so memory freed on
+ * one thread flows back to the threads that allocate. Objects are POOL_ALIGN aligned,
+ * sizes above the largest class go straight to posix_memalign.
+ */
+
+#define POOL_ALIGN 64
+#define POOL_CLASS_MIN 256
+/* classes per doubling, so a class wastes at most a fifth, e.g. 64KB plus its header lands in the 80KB class */
+#define POOL_CLASS_STEP 4
+/* POOL_CLASS_MIN up to 512KB */
+#define POOL_CLASS_LEN (11 * POOL_CLASS_STEP + 1)
+#define POOL_MAGAZINE_LEN 64
+#define POOL_MAGAZINE_SIZE (256 * 1024)
+#define POOL_DEPOT_MAX 16
+
+typedef struct
+{
+	unsigned int size;
+	unsigned long long miss;
+	unsigned long long refill;
+	unsigned long long flush;
+	unsigned long long release;
+	unsigned long long depot;
+} pool_stat_t;
+
+static inline void *posix_memalign2(size_t alignment, size_t size)
+{
+    void *p = NULL;
+
+    if(alignment < sizeof(void *))
+        alignment = sizeof(void *);
+
+    if((alignment & (alignment - 1)) != 0)
+        return NULL;
+
+    int ret = posix_memalign(&p, alignment, size);
+    if(ret != 0)
+        return NULL;
+
+    return p;
+}
+
+void *pool_alloc(size_t size);
+
+void pool_free(void *p);
+
+/* flushes the magazines of the calling thread to the depot, also done at thread exit */
+void pool_flush(void);
+
+int pool_get_stat(int index, pool_stat_t *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
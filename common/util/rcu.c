@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "queue.h"
+#include "rcu.h"
+
+unsigned long rcu_gp_ctr = RCU_GP_STEP;
+__thread rcu_reader_t rcu_reader;
+
+static LIST_HEAD(rcu_reader_list);
+static pthread_mutex_t rcu_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t rcu_key;
+static pthread_once_t rcu_key_once = PTHREAD_ONCE_INIT;
+static pthread_once_t rcu_thread_once = PTHREAD_ONCE_INIT;
+static queue_t rcu_queue;
+
+static void rcu_key_destructor(void *para)
+{
+	rcu_unregister_thread();
+}
+
+static void rcu_key_init(void)
+{
+	pthread_key_create(&rcu_key, rcu_key_destructor);
+}
+
+void rcu_register_thread(void)
+{
+	if(rcu_reader.is_register)
+		return;
+
+	pthread_once(&rcu_key_once, rcu_key_init);
+	pthread_setspecific(rcu_key, &rcu_reader);
+
+	pthread_mutex_lock(&rcu_mutex);
+	rcu_reader.ctr = 0;
+	rcu_reader.is_register = 1;
+	list_add_tail(&rcu_reader.node, &rcu_reader_list);
+	pthread_mutex_unlock(&rcu_mutex);
+}
+
+void rcu_unregister_thread(void)
+{
+	if(!rcu_reader.is_register)
+		return;
+
+	pthread_mutex_lock(&rcu_mutex);
+	list_del(&rcu_reader.node);
+	rcu_reader.is_register = 0;
+	pthread_mutex_unlock(&rcu_mutex);
+}
+
+void synchronize_rcu(void)
+{
+	pthread_mutex_lock(&rcu_mutex);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	unsigned long gp = rcu_gp_ctr + RCU_GP_STEP;
+	__atomic_store_n(&rcu_gp_ctr, gp, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	rcu_reader_t *link = NULL;
+	list_for_each_entry(link, &rcu_reader_list, node)
+	{
+		while(1)
+		{
+			unsigned long ctr = __atomic_load_n(&link->ctr, __ATOMIC_ACQUIRE);
+			if((ctr & RCU_NEST_MASK) == 0 || (ctr & ~RCU_NEST_MASK) == gp)
+				break;
+
+			sched_yield();
+		}
+	}
+
+	pthread_mutex_unlock(&rcu_mutex);
+}
+
+/* one grace period covers every callback queued before it starts, so each round takes all of them */
+static void *rcu_thread(void *para)
+{
+	LIST_HEAD(batch);
+
+	while(1)
+	{
+		struct list_head *node = queue_pop(&rcu_queue);
+		if(!node)
+			continue;
+
+		do
+			list_add_tail(node, &batch);
+		while((node = queue_try_pop(&rcu_queue)));
+
+		synchronize_rcu();
+
+		struct list_head *tmp = NULL;
+		list_for_each_safe(node, tmp, &batch)
+		{
+			struct rcu_head *head = container_of(node, struct rcu_head, node);
+			list_del(node);
+			if(head->func)
+				head->func(head);
+		}
+	}
+
+	return NULL;
+}
+
+static void rcu_thread_init(void)
+{
+	queue_init(&rcu_queue, -1);
+
+	pthread_t pthread;
+	int ret = pthread_create(&pthread, NULL, rcu_thread, NULL);
+	if(ret != 0)
+		printf("pthread_create failed: %s\n", strerror(ret));
+	pthread_detach(pthread);
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	if(!head || !func)
+		return;
+
+	pthread_once(&rcu_thread_once, rcu_thread_init);
+
+	head->func = func;
+	queue_push(&rcu_queue, &head->node);
+}
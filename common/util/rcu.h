@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "list.h"
+
+/*
+ * Minimal userspace RCU: readers only touch their own per-thread counter,
+ * writers unpublish a pointer and then wait for a grace period
+ * (synchronize_rcu) or hand the old object to call_rcu.
+ * synchronize_rcu must not be called inside a read-side critical section.
+ */
+
+#define RCU_NEST_MASK 0xFFFFUL
+#define RCU_GP_STEP (RCU_NEST_MASK + 1)
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+struct rcu_head
+{
+	void (*func)(struct rcu_head *head);
+	struct list_head node;
+};
+
+typedef struct
+{
+	unsigned long ctr;
+	char is_register;
+	struct list_head node;
+} rcu_reader_t;
+
+extern unsigned long rcu_gp_ctr;
+extern __thread rcu_reader_t rcu_reader;
+
+void rcu_register_thread(void);
+
+void rcu_unregister_thread(void);
+
+void synchronize_rcu(void);
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+
+static inline void rcu_read_lock(void)
+{
+	if(!rcu_reader.is_register)
+		rcu_register_thread();
+
+	unsigned long ctr = rcu_reader.ctr;
+	if((ctr & RCU_NEST_MASK) == 0)
+	{
+		__atomic_store_n(&rcu_reader.ctr, __atomic_load_n(&rcu_gp_ctr, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+	else
+		__atomic_store_n(&rcu_reader.ctr, ctr + 1, __ATOMIC_RELAXED);
+}
+
+static inline void rcu_read_unlock(void)
+{
+	__atomic_store_n(&rcu_reader.ctr, rcu_reader.ctr - 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include "thread2.h"
+
+void thread2_attr_init(thread2_attr_t *attr)
+{
+	if(!attr)
+		return;
+
+	memset(attr, 0x00, sizeof(thread2_attr_t));
+	attr->policy = SCHED_RR;
+	attr->priority = 80;
+}
+
+int thread2_attr_set_sched(thread2_attr_t *attr, int policy, int priority)
+{
+	if(!attr)
+		return -1;
+
+	if(priority < sched_get_priority_min(policy) || priority > sched_get_priority_max(policy))
+		return -1;
+
+	attr->policy = policy;
+	attr->priority = priority;
+
+	return 1;
+}
+
+int thread2_attr_set_cpu(thread2_attr_t *attr, int cpu)
+{
+	if(!attr || cpu < 0 || cpu >= 64)
+		return -1;
+
+	attr->cpu |= 1ULL << cpu;
+
+	return 1;
+}
+
+int thread2_attr_set_stack_size(thread2_attr_t *attr, size_t stack_size)
+{
+	if(!attr)
+		return -1;
+
+	attr->stack_size = stack_size;
+
+	return 1;
+}
+
+int thread2_create(pthread_t *pthread, thread2_attr_t *attr, void *(*func)(void *), void *para)
+{
+	if(!pthread || !func)
+		return -1;
+
+	pthread_attr_t pthread_attr;
+	pthread_attr_init(&pthread_attr);
+
+	if(attr)
+	{
+		struct sched_param param;
+		memset(&param, 0x00, sizeof(struct sched_param));
+		param.sched_priority = attr->priority;
+
+		pthread_attr_setinheritsched(&pthread_attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&pthread_attr, attr->policy);
+		pthread_attr_setschedparam(&pthread_attr, &param);
+		if(attr->cpu)
+		{
+			cpu_set_t cpu;
+			CPU_ZERO(&cpu);
+			for(int i = 0; i < 64; i++)
+				if(attr->cpu & (1ULL << i))
+					CPU_SET(i, &cpu);
+			pthread_attr_setaffinity_np(&pthread_attr, sizeof(cpu_set_t), &cpu);
+		}
+		if(attr->stack_size > 0)
+			pthread_attr_setstacksize(&pthread_attr, attr->stack_size);
+	}
+
+	int ret = pthread_create(pthread, &pthread_attr, func, para);
+	if(ret != 0)
+		printf("pthread_create failed: %s\n", strerror(ret));
+
+	pthread_attr_destroy(&pthread_attr);
+
+	return ret == 0 ? 1 : -1;
+}
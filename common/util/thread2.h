@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef _THREAD2_H_
+#define _THREAD2_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* scheduling of a thread, bit n of cpu allows cpu n, 0 leaves the affinity alone and stack_size 0 keeps the default */
+typedef struct
+{
+	int policy;
+	int priority;
+	unsigned long long cpu;
+	size_t stack_size;
+} thread2_attr_t;
+
+/* SCHED_RR priority 80 on any cpu, what the middleware threads always used */
+void thread2_attr_init(thread2_attr_t *attr);
+
+int thread2_attr_set_sched(thread2_attr_t *attr, int policy, int priority);
+
+int thread2_attr_set_cpu(thread2_attr_t *attr, int cpu);
+
+int thread2_attr_set_stack_size(thread2_attr_t *attr, size_t stack_size);
+
+/* creates a joinable thread, attr NULL uses the pthread defaults. Threads are stopped by their owner and joined, never cancelled */
+int thread2_create(pthread_t *pthread, thread2_attr_t *attr, void *(*func)(void *), void *para);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
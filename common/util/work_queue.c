@@ -13,14 +13,11 @@ static void *work_queue_thread(void *para)
 	
 	work_queue_t *work_queue = (work_queue_t *)para;
 	
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	
 	while(1)
 	{
 		struct list_head *node = queue_pop(&work_queue->queue);
 		if(!node)
-			continue;
+			break;
 		
 		work_t *work = container_of(node, work_t, node);
 		if(!work)
@@ -54,10 +51,7 @@ int work_queue_init(work_queue_t *work_queue, int count, int stack_size)
 		pthread_attr_setstacksize(&pthread_attr, work_queue->stack_size);
 	
 	for(int i = 0; i < work_queue->count; i++)
-	{
 		pthread_create(work_queue->pthread + i, &pthread_attr, work_queue_thread, work_queue);
-		pthread_detach(*(work_queue->pthread + i));
-	}
 	
 	pthread_attr_destroy(&pthread_attr);
 	
@@ -69,8 +63,13 @@ int work_queue_exit(work_queue_t *work_queue)
 	if(!work_queue)
 		return -1;
 	
+	queue_close(&work_queue->queue, WORK_QUEUE_DRAIN);
 	for(int i = 0; i < work_queue->count; i++)
-		pthread_cancel(*(work_queue->pthread + i));
+		pthread_join(*(work_queue->pthread + i), NULL);
+	
+	struct list_head *node = NULL;
+	while((node = queue_try_pop(&work_queue->queue)))
+		free(container_of(node, work_t, node));
 	
 	queue_exit(&work_queue->queue);
 	
@@ -115,7 +114,5 @@ int work_schedule(work_queue_t *work_queue, work_t *work)
 	if(!work_queue || !work)
 		return -1;
 	
-	queue_push(&work_queue->queue, &work->node);
-	
-	return 1;
+	return queue_push(&work_queue->queue, &work->node);
 }
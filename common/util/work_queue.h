@@ -10,6 +10,9 @@ extern "C"
 
 #include "queue.h"
 
+/* ms the threads keep running queued work after exit was called, work still queued then is freed unrun */
+#define WORK_QUEUE_DRAIN 1000
+
 typedef int (*work_func_t)(void *para);
 
 typedef struct
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "prio_queue.h"
+
+typedef struct
+{
+	int lane;
+	int value;
+	struct list_head node;
+} test_t;
+
+int main(int argc, char *argv[])
+{
+	prio_queue_t *queue = prio_queue_create(100, 4);
+	if(!queue)
+		return -1;
+
+	for(int i = 0; i < 30; i++)
+	{
+		test_t *test = (test_t *)calloc(1, sizeof(test_t));
+		if(!test)
+			break;
+
+		test->lane = i % 3 == 0 ? 0 : PRIO_QUEUE_LANE - 1;
+		test->value = i;
+		prio_queue_push(queue, &test->node, test->lane);
+	}
+
+	for(int i = 0; i < 30; i++)
+	{
+		struct list_head *node = prio_queue_pop(queue);
+		test_t *test = list_entry(node, test_t, node);
+		printf("lane: %d, value: %d\n", test->lane, test->value);
+		free(test);
+	}
+
+	prio_queue_destroy(queue);
+
+	return 0;
+}
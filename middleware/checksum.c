@@ -0,0 +1,196 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <string.h>
+#include <pthread.h>
+#include "checksum.h"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CHECKSUM_CRC32C_POLY 0x82F63B78
+
+static pthread_once_t checksum_once = PTHREAD_ONCE_INIT;
+static checksum_ops_t *checksum_ops[CHECKSUM_NUM];
+static int checksum_default = CHECKSUM_XXH32;
+static unsigned int checksum_crc32c_table[8][256];
+
+static unsigned int checksum_xxh32_hash(const char *buffer, int len)
+{
+	return XXH32(buffer, len, 0);
+}
+
+static void checksum_xxh32_reset(checksum_state_t *state)
+{
+	XXH32_reset(&state->xxh32, 0);
+}
+
+static void checksum_xxh32_update(checksum_state_t *state, const char *buffer, int len)
+{
+	XXH32_update(&state->xxh32, buffer, len);
+}
+
+static unsigned int checksum_xxh32_digest(checksum_state_t *state)
+{
+	return XXH32_digest(&state->xxh32);
+}
+
+static checksum_ops_t checksum_xxh32 = {"xxh32", checksum_xxh32_hash, checksum_xxh32_reset, checksum_xxh32_update, checksum_xxh32_digest};
+
+static unsigned int checksum_xxh3_hash(const char *buffer, int len)
+{
+	return (unsigned int)XXH3_64bits(buffer, len);
+}
+
+static void checksum_xxh3_reset(checksum_state_t *state)
+{
+	XXH3_64bits_reset(&state->xxh3);
+}
+
+static void checksum_xxh3_update(checksum_state_t *state, const char *buffer, int len)
+{
+	XXH3_64bits_update(&state->xxh3, buffer, len);
+}
+
+static unsigned int checksum_xxh3_digest(checksum_state_t *state)
+{
+	return (unsigned int)XXH3_64bits_digest(&state->xxh3);
+}
+
+static checksum_ops_t checksum_xxh3 = {"xxh3", checksum_xxh3_hash, checksum_xxh3_reset, checksum_xxh3_update, checksum_xxh3_digest};
+
+/* slicing by 8 bytes, for cpus without a crc32c instruction */
+static unsigned int checksum_crc32c_update2(unsigned int crc, const char *buffer, int len)
+{
+	const unsigned char *p = (const unsigned char *)buffer;
+	for(; len >= 8; len -= 8, p += 8)
+	{
+		unsigned int low = 0, high = 0;
+		memcpy(&low, p, 4);
+		memcpy(&high, p + 4, 4);
+		low ^= crc;
+		crc = checksum_crc32c_table[7][low & 0xFF] ^ checksum_crc32c_table[6][(low >> 8) & 0xFF] ^ \
+			checksum_crc32c_table[5][(low >> 16) & 0xFF] ^ checksum_crc32c_table[4][low >> 24] ^ \
+			checksum_crc32c_table[3][high & 0xFF] ^ checksum_crc32c_table[2][(high >> 8) & 0xFF] ^ \
+			checksum_crc32c_table[1][(high >> 16) & 0xFF] ^ checksum_crc32c_table[0][high >> 24];
+	}
+
+	for(; len > 0; len--, p++)
+		crc = checksum_crc32c_table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+
+	return crc;
+}
+
+static unsigned int checksum_crc32c_hash(const char *buffer, int len)
+{
+	return ~checksum_crc32c_update2(~0U, buffer, len);
+}
+
+static void checksum_crc32c_reset(checksum_state_t *state)
+{
+	state->crc = ~0U;
+}
+
+static void checksum_crc32c_update(checksum_state_t *state, const char *buffer, int len)
+{
+	state->crc = checksum_crc32c_update2(state->crc, buffer, len);
+}
+
+static unsigned int checksum_crc32c_digest(checksum_state_t *state)
+{
+	return ~state->crc;
+}
+
+static checksum_ops_t checksum_crc32c = {"crc32c", checksum_crc32c_hash, checksum_crc32c_reset, checksum_crc32c_update, checksum_crc32c_digest};
+
+#if defined(__x86_64__)
+unsigned int checksum_xxh3_avx2_hash(const char *buffer, int len);
+void checksum_xxh3_avx2_reset(checksum_state_t *state);
+void checksum_xxh3_avx2_update(checksum_state_t *state, const char *buffer, int len);
+unsigned int checksum_xxh3_avx2_digest(checksum_state_t *state);
+
+static checksum_ops_t checksum_xxh3_avx2 = {"xxh3-avx2", checksum_xxh3_avx2_hash, checksum_xxh3_avx2_reset, checksum_xxh3_avx2_update, checksum_xxh3_avx2_digest};
+
+__attribute__((target("sse4.2"))) static unsigned int checksum_crc32c_sse42_update2(unsigned int crc, const char *buffer, int len)
+{
+	unsigned long long crc2 = crc;
+	for(; len >= 8; len -= 8, buffer += 8)
+	{
+		unsigned long long value = 0;
+		memcpy(&value, buffer, 8);
+		crc2 = _mm_crc32_u64(crc2, value);
+	}
+
+	crc = (unsigned int)crc2;
+	for(; len > 0; len--, buffer++)
+		crc = _mm_crc32_u8(crc, *(const unsigned char *)buffer);
+
+	return crc;
+}
+
+static unsigned int checksum_crc32c_sse42_hash(const char *buffer, int len)
+{
+	return ~checksum_crc32c_sse42_update2(~0U, buffer, len);
+}
+
+static void checksum_crc32c_sse42_update(checksum_state_t *state, const char *buffer, int len)
+{
+	state->crc = checksum_crc32c_sse42_update2(state->crc, buffer, len);
+}
+
+static checksum_ops_t checksum_crc32c_sse42 = {"crc32c-sse4.2", checksum_crc32c_sse42_hash, checksum_crc32c_reset, checksum_crc32c_sse42_update, checksum_crc32c_digest};
+#endif
+
+static void checksum_init(void)
+{
+	for(int i = 0; i < 256; i++)
+	{
+		unsigned int crc = i;
+		for(int j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ CHECKSUM_CRC32C_POLY : crc >> 1;
+		checksum_crc32c_table[0][i] = crc;
+	}
+
+	for(int i = 0; i < 256; i++)
+		for(int j = 1; j < 8; j++)
+			checksum_crc32c_table[j][i] = checksum_crc32c_table[0][checksum_crc32c_table[j - 1][i] & 0xFF] ^ (checksum_crc32c_table[j - 1][i] >> 8);
+
+	checksum_ops[CHECKSUM_XXH32] = &checksum_xxh32;
+	checksum_ops[CHECKSUM_XXH3] = &checksum_xxh3;
+	checksum_ops[CHECKSUM_CRC32C] = &checksum_crc32c;
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		checksum_ops[CHECKSUM_XXH3] = &checksum_xxh3_avx2;
+	if(__builtin_cpu_supports("sse4.2"))
+		checksum_ops[CHECKSUM_CRC32C] = &checksum_crc32c_sse42;
+#endif
+}
+
+checksum_ops_t *checksum_get_ops(int algorithm)
+{
+	if(algorithm < 0 || algorithm >= CHECKSUM_NUM)
+		return NULL;
+
+	pthread_once(&checksum_once, checksum_init);
+
+	return checksum_ops[algorithm];
+}
+
+int checksum_get_default(void)
+{
+	pthread_once(&checksum_once, checksum_init);
+
+	return __atomic_load_n(&checksum_default, __ATOMIC_RELAXED);
+}
+
+int checksum_set_default(int algorithm)
+{
+	if(algorithm < 0 || algorithm >= CHECKSUM_NUM)
+		return -1;
+
+	pthread_once(&checksum_once, checksum_init);
+	__atomic_store_n(&checksum_default, algorithm, __ATOMIC_RELAXED);
+
+	return 1;
+}
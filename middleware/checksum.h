@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef XXH_STATIC_LINKING_ONLY
+#define XXH_STATIC_LINKING_ONLY
+#endif
+#include "xxhash.h"
+
+/* algorithm ids as carried in the header, XXH32 is 0 so peers that predate the id keep working */
+enum
+{
+	CHECKSUM_XXH32 = 0,
+	CHECKSUM_XXH3,
+	CHECKSUM_CRC32C,
+	CHECKSUM_NUM,
+};
+
+/* running checksum over several fragments, lives on the stack */
+typedef struct checksum_state
+{
+	union
+	{
+		XXH32_state_t xxh32;
+		XXH3_state_t xxh3;
+		unsigned int crc;
+	};
+} checksum_state_t;
+
+/* one implementation of an algorithm, XXH3 is cut to its low 32 bits to fit the header */
+typedef struct
+{
+	const char *name;
+	unsigned int (*hash)(const char *buffer, int len);
+	void (*reset)(checksum_state_t *state);
+	void (*update)(checksum_state_t *state, const char *buffer, int len);
+	unsigned int (*digest)(checksum_state_t *state);
+} checksum_ops_t;
+
+/* the fastest implementation of algorithm the running cpu supports, NULL for an unknown id */
+checksum_ops_t *checksum_get_ops(int algorithm);
+
+/* the algorithm messages are hashed with, CHECKSUM_XXH32 unless checksum_set_default picked another */
+int checksum_get_default(void);
+
+/*
+ * XXH3 is the fastest where the cpu has simd, CRC32C where it has a crc32c instruction. Peers that
+ * predate the algorithm id check everything with XXH32, switch only once none of them is left.
+ */
+int checksum_set_default(int algorithm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
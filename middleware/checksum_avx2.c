@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* XXH3 built with -mavx2, checksum.c only calls it once the running cpu reported avx2 */
+#if defined(__x86_64__)
+
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+
+struct checksum_state;
+
+unsigned int checksum_xxh3_avx2_hash(const char *buffer, int len)
+{
+	return (unsigned int)XXH3_64bits(buffer, len);
+}
+
+void checksum_xxh3_avx2_reset(struct checksum_state *state)
+{
+	XXH3_64bits_reset((XXH3_state_t *)state);
+}
+
+void checksum_xxh3_avx2_update(struct checksum_state *state, const char *buffer, int len)
+{
+	XXH3_64bits_update((XXH3_state_t *)state, buffer, len);
+}
+
+unsigned int checksum_xxh3_avx2_digest(struct checksum_state *state)
+{
+	return (unsigned int)XXH3_64bits_digest((XXH3_state_t *)state);
+}
+
+#endif
@@ -2,17 +2,50 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
 #include <string.h>
 #include <pthread.h>
 #include <sched.h>
+#include <unistd.h>
 #include "xxhash.h"
+#include "rcu.h"
 #include "util.h"
 #include "sk_buffer.h"
+#include "trace.h"
 #include "event.h"
 
 static char is_first = 0;
 static struct list_head event_thread_list;
 static pthread_mutex_t event_thread_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread sk_buffer_t *event_sk_buffer;
+static __thread unsigned int event_rpc_id;
+static __thread unsigned short event_rpc_source;
+static __thread unsigned int event_rpc_event;
+
+static void event_free(struct rcu_head *rcu)
+{
+	free(container_of(rcu, event_t, rcu));
+}
+
+static void event_set_free(struct rcu_head *rcu)
+{
+	free(container_of(rcu, event_set_t, rcu));
+}
+
+static void event_bucket_free(struct rcu_head *rcu)
+{
+	free(container_of(rcu, event_bucket_t, rcu));
+}
+
+static void event_range_free(struct rcu_head *rcu)
+{
+	event_range_t *range = container_of(rcu, event_range_t, rcu);
+
+	for(int i = 0; i < range->len; i++)
+		free(range->set[i]);
+	free(range);
+}
 
 static event_thread_t *event_thread_get_by_id(unsigned short id)
 {
@@ -48,13 +81,174 @@ static int event_thread_broadcast_callback(port_t *port, sk_buffer_t *sk_buffer)
 	if(!event_thread)
 		return -1;
 	
-	int len = sk_buffer->tail - sk_buffer->data;
-	sk_buffer_t *sk_buffer2 = sk_buffer_create(0, len, 0);
+	sk_buffer_t *sk_buffer2 = sk_buffer_clone(sk_buffer);
 	if(!sk_buffer2)
 		return -1;
 
-	sk_buffer_data_copy(sk_buffer2, sk_buffer->data, len);
-	queue_push(&port->queue, &sk_buffer2->node);
+	int ret = port_push(port, sk_buffer2, 1);
+	if(ret != 1)
+		sk_buffer_destroy(sk_buffer2);
+
+	return ret;
+}
+
+/* keys messages of conflated events by source and event, conflate is sorted and fixed once started */
+static unsigned long long event_thread_conflate_callback(port_t *port, sk_buffer_t *sk_buffer)
+{
+	event_thread_t *event_thread = (event_thread_t *)port_get_p(port);
+	if(!event_thread || sk_buffer->tail - sk_buffer->data < 16)
+		return 0;
+
+	unsigned short source = *(unsigned short *)(sk_buffer->data + 4);
+	unsigned int option = *(unsigned int *)(sk_buffer->data + 8);
+	unsigned int event = *(unsigned int *)(sk_buffer->data + 12);
+	if(option & (EVENT_OPTION_REQUEST | EVENT_OPTION_RESPONSE))
+		return 0;
+
+	int low = 0, high = event_thread->conflate_len - 1;
+	while(low <= high)
+	{
+		int mid = (low + high) / 2;
+		if(event < event_thread->conflate[mid])
+			high = mid - 1;
+		else if(event > event_thread->conflate[mid])
+			low = mid + 1;
+		else
+			return (1ULL << 48) | ((unsigned long long)source << 32) | event;
+	}
+
+	return 0;
+}
+
+/* whether deadline a comes before b */
+static int event_rpc_before2(struct timespec *a, struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* arms rpc_timer for deadline unless it is armed for an earlier one, called with rpc_mutex held */
+static void event_rpc_arm2(event_thread_t *event_thread, struct timespec *deadline)
+{
+	if(event_thread->rpc_deadline.tv_sec != 0 && !event_rpc_before2(deadline, &event_thread->rpc_deadline))
+		return;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	/* rounded up, the timer disarms on 0 */
+	long long ms = ((long long)(deadline->tv_sec - now.tv_sec) * 1000000000 + deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+	if(ms < 1)
+		ms = 1;
+
+	event_thread->rpc_deadline = *deadline;
+	timer2_start(&event_thread->rpc_timer, ms > INT_MAX ? INT_MAX : (int)ms, 1);
+}
+
+/* adds the request to the outstanding table, called with rpc_mutex held */
+static void event_rpc_add(event_thread_t *event_thread, event_rpc_t *rpc)
+{
+	hash_add(event_thread->rpc, EVENT_RPC_LEN, &rpc->node, rpc->id);
+	if(!rpc->cb)
+		return;
+
+	event_thread->rpc_async++;
+	event_rpc_arm2(event_thread, &rpc->deadline);
+}
+
+/* removes the request id from the outstanding table, the timer stops with the last asynchronous one, called with rpc_mutex held */
+static event_rpc_t *event_rpc_del(event_thread_t *event_thread, unsigned int id)
+{
+	event_rpc_t *link = NULL;
+	hash_for_each_possible(event_thread->rpc, EVENT_RPC_LEN, link, node, id)
+	{
+		if(link->id == id)
+		{
+			hash_del(&link->node);
+			if(link->cb && --event_thread->rpc_async == 0)
+			{
+				timer2_stop(&event_thread->rpc_timer);
+				memset(&event_thread->rpc_deadline, 0x00, sizeof(struct timespec));
+			}
+			return link;
+		}
+	}
+
+	return NULL;
+}
+
+/* hands the reply to the waiting caller or its callback, late replies are dropped */
+static void event_rpc_complete(event_thread_t *event_thread, unsigned int id, char *buffer, int buffer_len)
+{
+	pthread_mutex_lock(&event_thread->rpc_mutex);
+
+	event_rpc_t *rpc = event_rpc_del(event_thread, id);
+	if(!rpc || rpc->cb)
+	{
+		pthread_mutex_unlock(&event_thread->rpc_mutex);
+		if(rpc)
+		{
+			rpc->cb(event_thread, rpc->para, 1, buffer, buffer_len);
+			free(rpc);
+		}
+		return;
+	}
+
+	int len = buffer_len < *rpc->buffer_len ? buffer_len : *rpc->buffer_len;
+	if(rpc->buffer && len > 0)
+		memcpy(rpc->buffer, buffer, len);
+	*rpc->buffer_len = len;
+	rpc->status = 1;
+	pthread_cond_signal(&rpc->cond);
+
+	pthread_mutex_unlock(&event_thread->rpc_mutex);
+}
+
+/*
+ * times out the asynchronous requests past their deadline and arms the timer again for the nearest
+ * of the rest, blocking callers time out on their own
+ */
+static int event_rpc_timer(void *para)
+{
+	event_thread_t *event_thread = (event_thread_t *)para;
+	struct hlist_head expired = HLIST_HEAD_INIT;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&event_thread->rpc_mutex);
+
+	struct timespec deadline = {0, 0};
+	int bkt = 0;
+	event_rpc_t *link = NULL;
+	struct hlist_node *next = NULL;
+	hash_for_each_safe(event_thread->rpc, EVENT_RPC_LEN, bkt, next, link, node)
+	{
+		if(!link->cb)
+			continue;
+
+		if(event_rpc_before2(&now, &link->deadline))
+		{
+			if(deadline.tv_sec == 0 || event_rpc_before2(&link->deadline, &deadline))
+				deadline = link->deadline;
+			continue;
+		}
+
+		hash_del(&link->node);
+		hlist_add_head(&link->node, &expired);
+		event_thread->rpc_async--;
+	}
+
+	memset(&event_thread->rpc_deadline, 0x00, sizeof(struct timespec));
+	if(event_thread->rpc_async > 0)
+		event_rpc_arm2(event_thread, &deadline);
+
+	pthread_mutex_unlock(&event_thread->rpc_mutex);
+
+	hlist_for_each_entry_safe(link, next, &expired, node)
+	{
+		link->cb(event_thread, link->para, 0, NULL, 0);
+		free(link);
+	}
 
 	return 1;
 }
@@ -79,9 +273,19 @@ int event_thread_init(event_thread_t *event_thread, unsigned short id, unsigned
 		return -1;
 	
 	event_thread->id = id;
+	event_thread->priority = priority;
+	thread2_attr_init(&event_thread->attr);
+	event_thread->event_direct = (event_set_t **)calloc(EVENT_DIRECT_LEN, sizeof(event_set_t *));
+	if(!event_thread->event_direct)
+		return -1;
+
 	event_thread->port = port_create(event_thread->id);
 	if(!event_thread->port)
+	{
+		free(event_thread->event_direct);
+		event_thread->event_direct = NULL;
 		return -1;
+	}
 
 	port_set_broadcast_callback(event_thread->port, event_thread_broadcast_callback);
 	port_set_p(event_thread->port, event_thread);
@@ -90,6 +294,11 @@ int event_thread_init(event_thread_t *event_thread, unsigned short id, unsigned
 
 	INIT_LIST_HEAD(&event_thread->event_node);
 	pthread_mutex_init(&event_thread->event_node_mutex, NULL);
+	pthread_mutex_init(&event_thread->rpc_mutex, NULL);
+	hash_init(event_thread->rpc, EVENT_RPC_LEN);
+	event_thread->rpc_async = 0;
+	memset(&event_thread->rpc_deadline, 0x00, sizeof(struct timespec));
+	timer2_init(&event_thread->rpc_timer, event_rpc_timer, event_thread);
 	
 	pthread_mutex_lock(&event_thread_list_mutex);
 	list_add_tail(&event_thread->node, &event_thread_list);
@@ -105,6 +314,9 @@ int event_thread_exit(event_thread_t *event_thread)
 	if(!event_thread)
 		return ret;
 	
+	if(event_thread->is_start || event_thread->is_poll)
+		event_thread_stop(event_thread);
+
 	pthread_mutex_lock(&event_thread_list_mutex);
 	
 	event_thread_t *link = NULL, *next = NULL;
@@ -115,6 +327,51 @@ int event_thread_exit(event_thread_t *event_thread)
 			list_del(&link->node);
 			sem_destroy(&link->port_sem);
 			port_destroy(link->port);
+
+			event_t *event = NULL, *event2 = NULL;
+			list_for_each_entry_safe(event, event2, &link->event_node, node)
+			{
+				list_del(&event->node);
+				free(event);
+			}
+			for(int i = 0; i < EVENT_DIRECT_LEN; i++)
+				free(link->event_direct[i]);
+			free(link->event_direct);
+			link->event_direct = NULL;
+			if(link->event_range)
+				event_range_free(&link->event_range->rcu);
+			link->event_range = NULL;
+			for(int i = 0; i < link->worker_len; i++)
+			{
+				struct list_head *node = NULL;
+				while((node = queue_try_pop(&link->worker[i].queue)))
+					sk_buffer_destroy(container_of(node, sk_buffer_t, node));
+				queue_exit(&link->worker[i].queue);
+			}
+			free(link->worker);
+			link->worker = NULL;
+			free(link->conflate);
+			link->conflate = NULL;
+			link->conflate_len = 0;
+			link->worker_len = 0;
+			for(int i = 0; i < EVENT_HASH_LEN; i++)
+			{
+				free(link->event_hash[i]);
+				link->event_hash[i] = NULL;
+			}
+			pthread_mutex_destroy(&link->event_node_mutex);
+			timer2_exit(&link->rpc_timer);
+			int bkt = 0;
+			event_rpc_t *rpc = NULL;
+			struct hlist_node *rpc2 = NULL;
+			hash_for_each_safe(link->rpc, EVENT_RPC_LEN, bkt, rpc2, rpc, node)
+			{
+				hash_del(&rpc->node);
+				if(rpc->cb)
+					free(rpc);
+			}
+			pthread_mutex_destroy(&link->rpc_mutex);
+
 			ret = 1;
 			goto exit;
 		}
@@ -156,207 +413,967 @@ int event_thread_destroy(event_thread_t *event_thread)
 	return 1;
 }
 
-static event_t *event_get_by_id(event_thread_t *event_thread, unsigned int event)
+/* copies old with add appended or del dropped */
+static event_set_t *event_set_copy(event_set_t *old, unsigned int event, unsigned int last, event_t *add, event_t *del)
 {
-	event_t *ret = NULL;
-	
-	if(!event_thread)
+	int len = old ? old->len : 0;
+
+	event_set_t *new = (event_set_t *)calloc(1, sizeof(event_set_t) + (len + 1) * sizeof(event_t *));
+	if(!new)
 		return NULL;
-	
-	pthread_mutex_lock(&event_thread->event_node_mutex);
-	
+
+	new->event = event;
+	new->last = last;
+
+	for(int i = 0; i < len; i++)
+		if(old->handler[i] != del)
+			new->handler[new->len++] = old->handler[i];
+	if(add)
+		new->handler[new->len++] = add;
+
+	return new;
+}
+
+/* publishes a new handler set for the direct id event, called with event_node_mutex held */
+static int event_direct_update(event_thread_t *event_thread, unsigned int event, event_t *add, event_t *del)
+{
+	event_set_t *old = event_thread->event_direct[event];
+	event_set_t *new = event_set_copy(old, event, event, add, del);
+	if(!new)
+		return -1;
+
+	if(new->len == 0)
+	{
+		free(new);
+		new = NULL;
+	}
+
+	rcu_assign_pointer(event_thread->event_direct[event], new);
+	if(old)
+		call_rcu(&old->rcu, event_set_free);
+
+	return 1;
+}
+
+/* publishes a copy of the bucket of event with add appended or del dropped, called with event_node_mutex held */
+static int event_bucket_update(event_thread_t *event_thread, unsigned int event, event_t *add, event_t *del)
+{
+	int index = EVENT_HASH_INDEX(event);
+	event_bucket_t *old = event_thread->event_hash[index];
+	int len = old ? old->len : 0;
+
+	event_bucket_t *new = (event_bucket_t *)calloc(1, sizeof(event_bucket_t) + (len + 1) * sizeof(event_t *));
+	if(!new)
+		return -1;
+
+	for(int i = 0; i < len; i++)
+		if(old->event[i] != del)
+			new->event[new->len++] = old->event[i];
+	if(add)
+		new->event[new->len++] = add;
+
+	if(new->len == 0)
+	{
+		free(new);
+		new = NULL;
+	}
+
+	rcu_assign_pointer(event_thread->event_hash[index], new);
+	if(old)
+		call_rcu(&old->rcu, event_bucket_free);
+
+	return 1;
+}
+
+static int event_bound_cmp(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * rebuilds the disjoint spans of the ranges from event_node, called with event_node_mutex held.
+ * Ranges over direct ids live here as well, so a range costs one set per span instead of one per id.
+ */
+static int event_range_update(event_thread_t *event_thread)
+{
+	event_range_t *old = event_thread->event_range;
+	int num = 0;
+
 	event_t *link = NULL;
 	list_for_each_entry(link, &event_thread->event_node, node)
+		if(link->event != link->last)
+			num++;
+
+	event_range_t *new = NULL;
+	unsigned long long *bound = NULL;
+	if(num == 0)
+		goto publish;
+
+	bound = (unsigned long long *)calloc(num * 2, sizeof(unsigned long long));
+	new = (event_range_t *)calloc(1, sizeof(event_range_t) + num * 2 * sizeof(event_set_t *));
+	if(!bound || !new)
+		goto error;
+
+	int len = 0;
+	list_for_each_entry(link, &event_thread->event_node, node)
+	{
+		if(link->event == link->last)
+			continue;
+
+		bound[len++] = link->event;
+		bound[len++] = (unsigned long long)link->last + 1;
+	}
+	qsort(bound, len, sizeof(unsigned long long), event_bound_cmp);
+
+	for(int i = 0; i + 1 < len; i++)
 	{
-		if(link->event == event)
+		if(bound[i] == bound[i + 1])
+			continue;
+
+		unsigned int event = bound[i], last = bound[i + 1] - 1;
+		event_set_t *set = NULL;
+		list_for_each_entry(link, &event_thread->event_node, node)
 		{
-			ret = link;
-			goto exit;
+			if(link->event == link->last || link->event > event || link->last < last)
+				continue;
+
+			event_set_t *set2 = event_set_copy(set, event, last, link, NULL);
+			free(set);
+			set = set2;
+			if(!set)
+				goto error;
 		}
+		if(set)
+			new->set[new->len++] = set;
 	}
-	
-exit:
-	pthread_mutex_unlock(&event_thread->event_node_mutex);
-	
-	return ret;
+
+	free(bound);
+
+publish:
+	rcu_assign_pointer(event_thread->event_range, new);
+	if(old)
+		call_rcu(&old->rcu, event_range_free);
+
+	return 1;
+
+error:
+	free(bound);
+	if(new)
+		event_range_free(&new->rcu);
+
+	return -1;
+}
+
+/* adds link to or removes it from the table holding its ids, called with event_node_mutex held */
+static int event_publish(event_thread_t *event_thread, event_t *link, char is_add)
+{
+	event_t *add = is_add ? link : NULL;
+	event_t *del = is_add ? NULL : link;
+
+	if(link->event != link->last)
+		return event_range_update(event_thread);
+
+	if(link->event < EVENT_DIRECT_LEN)
+		return event_direct_update(event_thread, link->event, add, del);
+
+	return event_bucket_update(event_thread, link->event, add, del);
 }
 
 int event_thread_attach_event(event_thread_t *event_thread, unsigned int event, event_callback_t cb, void *para)
 {
-	if(!event_thread || !cb)
+	return event_thread_attach_event_range(event_thread, event, event, cb, para);
+}
+
+int event_thread_attach_event_range(event_thread_t *event_thread, unsigned int event, unsigned int last, event_callback_t cb, void *para)
+{
+	if(!event_thread || !cb || event > last)
 		return -1;
 	
-	event_t *event2 = event_get_by_id(event_thread, event);
-	if(event2)
-		return 1;
+	pthread_mutex_lock(&event_thread->event_node_mutex);
+
+	event_t *link = NULL;
+	list_for_each_entry(link, &event_thread->event_node, node)
+	{
+		if(link->event == event && link->last == last && link->cb == cb && link->para == para)
+		{
+			pthread_mutex_unlock(&event_thread->event_node_mutex);
+			return 1;
+		}
+	}
 	
-	event2 = (event_t *)calloc(1, sizeof(event_t));
+	event_t *event2 = (event_t *)calloc(1, sizeof(event_t));
 	if(!event2)
+	{
+		pthread_mutex_unlock(&event_thread->event_node_mutex);
 		return -1;
+	}
 	
 	event2->event = event;
+	event2->last = last;
 	event2->cb = cb;
 	event2->para = para;
 	
-	pthread_mutex_lock(&event_thread->event_node_mutex);
 	list_add_tail(&event2->node, &event_thread->event_node);
+	if(event_publish(event_thread, event2, 1) != 1)
+	{
+		list_del(&event2->node);
+		event_publish(event_thread, event2, 0);
+		pthread_mutex_unlock(&event_thread->event_node_mutex);
+		call_rcu(&event2->rcu, event_free);
+		return -1;
+	}
+
 	pthread_mutex_unlock(&event_thread->event_node_mutex);
+
+	if(event == last)
+		port_join(event_thread->port, event);
+	else
+		port_join_range(event_thread->port, event, last);
 	
 	return 1;
 }
 
 int event_thread_detach_event(event_thread_t *event_thread, unsigned int event)
 {
-	int ret = -1;
-	
-	if(!event_thread)
-		return -1;
-	
-	pthread_mutex_lock(&event_thread->event_node_mutex);
-	
-	event_t *link = NULL, *next = NULL;
-	list_for_each_entry_safe(link, next, &event_thread->event_node, node)
-	{
-		if(link->event == event)
-		{
-			list_del(&link->node);
-			free(link);
-			ret = 1;
-			goto exit;
-		}
-    }
-	
-exit:
-	pthread_mutex_unlock(&event_thread->event_node_mutex);
-	
-	return ret;
+	return event_thread_detach_event_range(event_thread, event, event, NULL, NULL);
 }
 
-static void *event_thread2(void *para)
+int event_thread_detach_event_range(event_thread_t *event_thread, unsigned int event, unsigned int last, event_callback_t cb, void *para)
 {
-	if(!para)
-		return NULL;
-	
-	event_thread_t *event_thread = (event_thread_t *)para;
-	if(!event_thread->port)
-		return NULL;
+	int ret = -1;
 	
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	if(!event_thread || event > last)
+		return -1;
 	
-	port_set_state(event_thread->port, PORT_STATE_CONN);
-
-	sem_post(&event_thread->port_sem);
-
 	while(1)
 	{
-		sk_buffer_t *sk_buffer = port_recv(event_thread->port);
-		if(!sk_buffer)
-			continue;
-
-		unsigned int hash = *(unsigned int *)sk_buffer->data;
-		sk_buffer_pull(sk_buffer, 4);
-		XXH32_hash_t hash2 = XXH32(sk_buffer->data, sk_buffer->tail - sk_buffer->data, 0);
-		if(hash != hash2)
-		{
-			printf("hash values are not equal, hash-hash2: %x-%x\n", hash, hash2);
-			sk_buffer_destroy(sk_buffer);
-			continue;
-		}
-
-		unsigned short source = *(unsigned short *)sk_buffer->data;
-		sk_buffer_pull(sk_buffer, 2);
-		sk_buffer_pull(sk_buffer, 2);
-		unsigned int event = *(unsigned int *)sk_buffer->data;
-		sk_buffer_pull(sk_buffer, 4);
-		unsigned int len = *(unsigned int *)sk_buffer->data;
-		sk_buffer_pull(sk_buffer, 4);
-
 		pthread_mutex_lock(&event_thread->event_node_mutex);
-		
-		event_t *link = NULL;
+
+		event_t *link = NULL, *event2 = NULL;
 		list_for_each_entry(link, &event_thread->event_node, node)
 		{
-			if(link->event == event)
+			if(link->event == event && link->last == last && (!cb || (link->cb == cb && link->para == para)))
 			{
-				if(link->cb)
-					link->cb(event_thread, link->para, source, event, sk_buffer->data, len);
+				event2 = link;
+				break;
 			}
 		}
-		
+
+		if(!event2)
+		{
+			pthread_mutex_unlock(&event_thread->event_node_mutex);
+			break;
+		}
+
+		list_del(&event2->node);
+		event_publish(event_thread, event2, 0);
+
 		pthread_mutex_unlock(&event_thread->event_node_mutex);
 
-		sk_buffer_destroy(sk_buffer);
+		call_rcu(&event2->rcu, event_free);
+		if(event == last)
+			port_leave(event_thread->port, event);
+		else
+			port_leave_range(event_thread->port, event, last);
+		ret = 1;
 	}
 	
-	return NULL;
+	return ret;
 }
 
-int event_thread_start(event_thread_t *event_thread)
+/* copies up to max handlers of event, exact ones before ranges, returns how many there are. Called under rcu_read_lock */
+static int event_collect2(event_thread_t *event_thread, unsigned int event, event_handler_t *handler, int max)
 {
-	if(!event_thread)
-		return -1;
+	int len = 0;
 
-	set_root_caps();
+	if(event < EVENT_DIRECT_LEN)
+	{
+		event_set_t *set = rcu_dereference(event_thread->event_direct[event]);
+		for(int i = 0; set && i < set->len; i++, len++)
+			if(len < max)
+				handler[len] = (event_handler_t){set->handler[i]->cb, set->handler[i]->para};
+	}
+	else
+	{
+		event_bucket_t *bucket = rcu_dereference(event_thread->event_hash[EVENT_HASH_INDEX(event)]);
+		for(int i = 0; bucket && i < bucket->len; i++)
+		{
+			if(bucket->event[i]->event != event)
+				continue;
 
-    pthread_attr_t attr;
-    struct sched_param param;
+			if(len < max)
+				handler[len] = (event_handler_t){bucket->event[i]->cb, bucket->event[i]->para};
+			len++;
+		}
+	}
 
-	pthread_attr_init(&attr);
-	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
-	pthread_attr_setschedpolicy(&attr, SCHED_RR);
-	param.sched_priority = 80;
-	pthread_attr_setschedparam(&attr, &param);
+	event_range_t *range = rcu_dereference(event_thread->event_range);
+	if(!range)
+		return len;
 
-	int ret = pthread_create(&event_thread->pthread, &attr, event_thread2, event_thread);
-	if(ret != 0)
-		printf("pthread_create failed: %s\n", strerror(ret));
-	pthread_detach(event_thread->pthread);
-	sem_wait(&event_thread->port_sem);
+	int low = 0, high = range->len - 1;
+	while(low <= high)
+	{
+		int mid = (low + high) / 2;
+		event_set_t *set = range->set[mid];
+		if(event < set->event)
+			high = mid - 1;
+		else if(event > set->last)
+			low = mid + 1;
+		else
+		{
+			for(int i = 0; i < set->len; i++, len++)
+				if(len < max)
+					handler[len] = (event_handler_t){set->handler[i]->cb, set->handler[i]->para};
+			break;
+		}
+	}
+
+	return len;
+}
+
+/*
+ * runs the handlers of event. They are copied out of the snapshot first, so callbacks run outside
+ * the read-side section and may block or destroy ports without holding up any grace period.
+ */
+static void event_dispatch(event_thread_t *event_thread, unsigned short source, unsigned int event, char *buffer, int buffer_len)
+{
+	event_handler_t stack[EVENT_HANDLER_STACK];
+	event_handler_t *handler = stack;
+
+	rcu_read_lock();
+
+	int len = event_collect2(event_thread, event, handler, EVENT_HANDLER_STACK);
+	if(len > EVENT_HANDLER_STACK)
+	{
+		/* an attach or detach may have swapped the snapshot in between, run what was copied */
+		handler = (event_handler_t *)malloc(len * sizeof(event_handler_t));
+		if(handler)
+		{
+			int len2 = event_collect2(event_thread, event, handler, len);
+			if(len2 < len)
+				len = len2;
+		}
+	}
+
+	rcu_read_unlock();
+
+	if(!handler)
+		return;
+
+	for(int i = 0; i < len; i++)
+		handler[i].cb(event_thread, handler[i].para, source, event, buffer, buffer_len);
+
+	if(handler != stack)
+		free(handler);
+}
+
+/* verifies and unpacks one received message and runs its handlers */
+static void event_recv2(event_thread_t *event_thread, sk_buffer_t *sk_buffer)
+{
+	if(trace_get(sk_buffer))
+	{
+		trace_stamp(sk_buffer, TRACE_DISPATCH);
+		trace_record(sk_buffer);
+	}
+
+	unsigned int hash = *(unsigned int *)sk_buffer->data;
+	sk_buffer_pull(sk_buffer, 4);
+	if(port_get_integrity(event_thread->port) == PORT_INTEGRITY_HOP && (*(unsigned int *)(sk_buffer->data + 4) & PORT_OPTION_HASH))
+	{
+		unsigned int hash2 = trace_hash(sk_buffer);
+		if(hash != hash2)
+		{
+			printf("hash values are not equal, hash-hash2: %x-%x\n", hash, hash2);
+			sk_buffer_destroy(sk_buffer);
+			return;
+		}
+	}
+
+	unsigned short source = *(unsigned short *)sk_buffer->data;
+	sk_buffer_pull(sk_buffer, 2);
+	sk_buffer_pull(sk_buffer, 2);
+	unsigned int option = *(unsigned int *)sk_buffer->data;
+	sk_buffer_pull(sk_buffer, 4);
+	unsigned int event = *(unsigned int *)sk_buffer->data;
+	sk_buffer_pull(sk_buffer, 4);
+	unsigned int len = *(unsigned int *)sk_buffer->data;
+	sk_buffer_pull(sk_buffer, 4);
+	unsigned int id = 0;
+	if(option & (EVENT_OPTION_REQUEST | EVENT_OPTION_RESPONSE))
+	{
+		id = *(unsigned int *)sk_buffer->data;
+		sk_buffer_pull(sk_buffer, 4);
+	}
+
+	/* a gateway checked the frame without the correlation id, which may have eaten into the payload */
+	if((long long)len + ((option & TRACE_OPTION) ? TRACE_SIZE : 0) > sk_buffer_len(sk_buffer))
+	{
+		printf("message of event %u is shorter than its payload of %u bytes\n", event, len);
+		sk_buffer_destroy(sk_buffer);
+		return;
+	}
+
+	sk_buffer_t *payload = NULL;
+	if(sk_buffer->frag && sk_buffer->data == sk_buffer->tail && !sk_buffer->frag->frag)
+		payload = sk_buffer_get(sk_buffer->frag);
+	else
+		payload = sk_buffer_linearize(sk_buffer);
+	if(!payload)
+	{
+		sk_buffer_destroy(sk_buffer);
+		return;
+	}
+
+	if(option & EVENT_OPTION_RESPONSE)
+	{
+		event_rpc_complete(event_thread, id, payload->data, len);
+		sk_buffer_destroy(payload);
+		sk_buffer_destroy(sk_buffer);
+		return;
+	}
+
+	event_sk_buffer = payload;
+	if(option & EVENT_OPTION_REQUEST)
+	{
+		event_rpc_id = id;
+		event_rpc_source = source;
+		event_rpc_event = event;
+	}
+
+	event_dispatch(event_thread, source, event, payload->data, len);
+
+	event_sk_buffer = NULL;
+	event_rpc_id = 0;
+
+	sk_buffer_destroy(payload);
+	sk_buffer_destroy(sk_buffer);
+}
+
+/* picks the worker from source and event in the header, which always sits in the first buffer */
+static event_worker_t *event_worker_get(event_thread_t *event_thread, sk_buffer_t *sk_buffer)
+{
+	unsigned int key = 0;
+
+	if(sk_buffer->tail - sk_buffer->data >= 16)
+	{
+		unsigned short source = *(unsigned short *)(sk_buffer->data + 4);
+		unsigned int event = *(unsigned int *)(sk_buffer->data + 12);
+		if(event_thread->key)
+			key = event_thread->key(event_thread->key_para, source, event);
+		else
+		{
+			unsigned int id[2] = {source, event};
+			key = XXH32(id, sizeof(id), 0);
+		}
+	}
+
+	return &event_thread->worker[key % event_thread->worker_len];
+}
+
+static void *event_worker2(void *para)
+{
+	event_worker_t *worker = (event_worker_t *)para;
+
+	while(1)
+	{
+		struct list_head *node = queue_pop(&worker->queue);
+		if(!node)
+			break;
+
+		event_recv2(worker->event_thread, container_of(node, sk_buffer_t, node));
+	}
+
+	return NULL;
+}
+
+static void *event_thread2(void *para)
+{
+	if(!para)
+		return NULL;
+	
+	event_thread_t *event_thread = (event_thread_t *)para;
+	if(!event_thread->port)
+		return NULL;
+	
+	port_set_state(event_thread->port, PORT_STATE_CONN);
+
+	sem_post(&event_thread->port_sem);
+
+	/* NULL once event_thread_stop closed the port and the drain is over */
+	while(1)
+	{
+		sk_buffer_t *sk_buffer = port_recv(event_thread->port);
+		if(!sk_buffer)
+			break;
+
+		if(event_thread->worker_len > 0)
+		{
+			event_worker_t *worker = event_worker_get(event_thread, sk_buffer);
+			if(queue_push(&worker->queue, &sk_buffer->node) != 1)
+				sk_buffer_destroy(sk_buffer);
+		}
+		else
+			event_recv2(event_thread, sk_buffer);
+	}
+	
+	return NULL;
+}
+
+int event_thread_set_conflate(event_thread_t *event_thread, unsigned int event)
+{
+	if(!event_thread || port_get_state(event_thread->port) == PORT_STATE_CONN)
+		return -1;
 
-	pthread_attr_destroy(&attr);
+	int i = 0;
+	while(i < event_thread->conflate_len && event_thread->conflate[i] < event)
+		i++;
+	if(i < event_thread->conflate_len && event_thread->conflate[i] == event)
+		return 1;
+
+	unsigned int *conflate = (unsigned int *)realloc(event_thread->conflate, (event_thread->conflate_len + 1) * sizeof(unsigned int));
+	if(!conflate)
+		return -1;
+
+	memmove(conflate + i + 1, conflate + i, (event_thread->conflate_len - i) * sizeof(unsigned int));
+	conflate[i] = event;
+	event_thread->conflate = conflate;
+	event_thread->conflate_len++;
+
+	port_set_conflate_callback(event_thread->port, event_thread_conflate_callback);
+
+	return 1;
+}
+
+int event_thread_set_attr(event_thread_t *event_thread, thread2_attr_t *attr)
+{
+	if(!event_thread || !attr || port_get_state(event_thread->port) == PORT_STATE_CONN)
+		return -1;
+
+	event_thread->attr = *attr;
+
+	return 1;
+}
+
+int event_thread_set_spin(event_thread_t *event_thread, int max)
+{
+	if(!event_thread || port_get_state(event_thread->port) == PORT_STATE_CONN)
+		return -1;
+
+	return port_set_spin(event_thread->port, max);
+}
+
+int event_thread_set_integrity(event_thread_t *event_thread, char integrity)
+{
+	if(!event_thread)
+		return -1;
+
+	return port_set_integrity(event_thread->port, integrity);
+}
+
+int event_thread_set_trace(event_thread_t *event_thread, char is_trace)
+{
+	if(!event_thread)
+		return -1;
+
+	__atomic_store_n(&event_thread->is_trace, is_trace, __ATOMIC_RELAXED);
+
+	return 1;
+}
+
+int event_thread_set_worker(event_thread_t *event_thread, int num, event_key_t key, void *para)
+{
+	if(!event_thread || num < 0 || num > EVENT_WORKER_MAX || event_thread->worker)
+		return -1;
+
+	if(num <= 1)
+		return 1;
+
+	event_thread->worker = (event_worker_t *)calloc(num, sizeof(event_worker_t));
+	if(!event_thread->worker)
+		return -1;
+
+	for(int i = 0; i < num; i++)
+	{
+		event_thread->worker[i].event_thread = event_thread;
+		queue_init(&event_thread->worker[i].queue, PORT_QUEUE_MAX);
+	}
+
+	event_thread->key = key;
+	event_thread->key_para = para;
+	event_thread->worker_len = num;
 
 	return 1;
 }
 
+int event_thread_start(event_thread_t *event_thread)
+{
+	if(!event_thread || event_thread->is_start || event_thread->is_poll)
+		return -1;
+
+	set_root_caps();
+
+	port_open(event_thread->port);
+
+	int i = 0;
+	for(i = 0; i < event_thread->worker_len; i++)
+	{
+		queue_open(&event_thread->worker[i].queue);
+		if(thread2_create(&event_thread->worker[i].pthread, &event_thread->attr, event_worker2, &event_thread->worker[i]) != 1)
+			goto exit;
+	}
+
+	int ret = thread2_create(&event_thread->pthread, &event_thread->attr, event_thread2, event_thread);
+	if(ret != 1)
+		goto exit;
+	sem_wait(&event_thread->port_sem);
+	event_thread->is_start = 1;
+
+	return 1;
+
+exit:
+	while(i-- > 0)
+	{
+		queue_close(&event_thread->worker[i].queue, 0);
+		pthread_join(event_thread->worker[i].pthread, NULL);
+	}
+
+	return -1;
+}
+
 int event_thread_stop(event_thread_t *event_thread)
 {
 	if(!event_thread)
 		return -1;
 
 	port_set_state(event_thread->port, PORT_STATE_DISCONN);
-	pthread_cancel(event_thread->pthread);
+	port_close(event_thread->port, EVENT_DRAIN_TIME);
+
+	if(event_thread->is_start)
+	{
+		pthread_join(event_thread->pthread, NULL);
+
+		/* the workers drain after the thread, which may still have handed them messages */
+		for(int i = 0; i < event_thread->worker_len; i++)
+			queue_close(&event_thread->worker[i].queue, EVENT_DRAIN_TIME);
+		for(int i = 0; i < event_thread->worker_len; i++)
+			pthread_join(event_thread->worker[i].pthread, NULL);
+	}
+	event_thread->is_start = 0;
+	event_thread->is_poll = 0;
+
+	sk_buffer_t *sk_buffer = NULL;
+	while((sk_buffer = port_try_recv(event_thread->port)))
+		sk_buffer_destroy(sk_buffer);
+
+	for(int i = 0; i < event_thread->worker_len; i++)
+	{
+		struct list_head *node = NULL;
+		while((node = queue_try_pop(&event_thread->worker[i].queue)))
+			sk_buffer_destroy(container_of(node, sk_buffer_t, node));
+	}
 
 	return 1;
 }
 
-int event_send(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len)
+int event_thread_get_fd(event_thread_t *event_thread)
 {
-	if(!event_thread || dest == PORT_UNKOWN)
+	if(!event_thread)
 		return -1;
 
-	sk_buffer_t *sk_buffer = sk_buffer_create(HEADROOM_SIZE, buffer_len, TAILROOM_SIZE);
-	if(!sk_buffer)
+	if(event_thread->is_start)
 		return -1;
 
-	sk_buffer_data_copy(sk_buffer, buffer, buffer_len);
+	int fd = port_get_fd(event_thread->port);
+	if(fd < 0 || event_thread->is_poll)
+		return fd;
+
+	port_open(event_thread->port);
+	event_thread->is_poll = 1;
+	port_set_state(event_thread->port, PORT_STATE_CONN);
+
+	return fd;
+}
+
+int event_thread_dispatch(event_thread_t *event_thread, int max)
+{
+	if(!event_thread || !event_thread->is_poll || max <= 0)
+		return -1;
+
+	unsigned long long value = 0;
+	if(read(event_thread->port->fd, &value, sizeof(value)) < 0)
+		value = 0;
+
+	int num = 0;
+	while(num < max)
+	{
+		sk_buffer_t *sk_buffer = port_try_recv(event_thread->port);
+		if(!sk_buffer)
+			return num;
+
+		event_recv2(event_thread, sk_buffer);
+		num++;
+	}
+
+	/* more may wait, keep the descriptor readable */
+	value = 1;
+	if(write(event_thread->port->fd, &value, sizeof(value)) < 0)
+		return num;
+
+	return num;
+}
+
+sk_buffer_t *event_hold(event_thread_t *event_thread)
+{
+	if(!event_thread || !event_sk_buffer)
+		return NULL;
+
+	return sk_buffer_get(event_sk_buffer);
+}
+
+int event_release(sk_buffer_t *sk_buffer)
+{
+	return sk_buffer_put(sk_buffer);
+}
+
+/* pushes the header in front of the payload already held by sk_buffer and its fragments, id goes along with an rpc flag */
+static sk_buffer_t *event_pack3(event_thread_t *event_thread, unsigned short dest, unsigned int event, sk_buffer_t *sk_buffer, int buffer_len, unsigned int flag, unsigned int id)
+{
+	if(__atomic_load_n(&event_thread->is_trace, __ATOMIC_RELAXED) && dest != PORT_BROADCAST && trace_append(sk_buffer) == 1)
+		flag |= TRACE_OPTION;
+
+	/* a broadcast is shared by its receivers, so a gateway cannot hash it on the way out */
+	char integrity = port_get_integrity(event_thread->port);
+	if(integrity == PORT_INTEGRITY_HOP || (integrity == PORT_INTEGRITY_EDGE && dest == PORT_BROADCAST))
+		flag |= PORT_OPTION_HASH | (checksum_get_default() << PORT_OPTION_CHECKSUM_SHIFT);
+
+	unsigned int option = event_thread->priority | flag;
+	sk_buffer->priority = PORT_OPTION_PRIORITY(option);
+	if(flag & (EVENT_OPTION_REQUEST | EVENT_OPTION_RESPONSE))
+		sk_buffer_push_copy(sk_buffer, (char *)&id, 4);
     sk_buffer_push_copy(sk_buffer, (char *)&buffer_len, 4);
 	sk_buffer_push_copy(sk_buffer, (char *)&event, 4);
+	sk_buffer_push_copy(sk_buffer, (char *)&option, 4);
 	sk_buffer_push_copy(sk_buffer, (char *)&dest, 2);
 	sk_buffer_push_copy(sk_buffer, (char *)&event_thread->id, 2);
-	XXH32_hash_t hash = XXH32(sk_buffer->data, sk_buffer->tail - sk_buffer->data, 0);
+	unsigned int hash = (flag & PORT_OPTION_HASH) ? trace_hash(sk_buffer) : 0;
 	sk_buffer_push_copy(sk_buffer, (char *)&hash, 4);
 
+	return sk_buffer;
+}
+
+static sk_buffer_t *event_pack2(event_thread_t *event_thread, unsigned short dest, unsigned int event, sk_buffer_t *sk_buffer, int buffer_len)
+{
+	return event_pack3(event_thread, dest, event, sk_buffer, buffer_len, 0, 0);
+}
+
+static sk_buffer_t *event_pack(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len)
+{
+	sk_buffer_t *sk_buffer = sk_buffer_create(HEADROOM_SIZE, buffer_len, TAILROOM_SIZE);
+	if(!sk_buffer)
+		return NULL;
+
+	sk_buffer_data_copy(sk_buffer, buffer, buffer_len);
+
+	return event_pack2(event_thread, dest, event, sk_buffer, buffer_len);
+}
+
+int event_send(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len)
+{
+	if(!event_thread || dest == PORT_UNKOWN)
+		return -1;
+
+	sk_buffer_t *sk_buffer = event_pack(event_thread, dest, event, buffer, buffer_len);
+	if(!sk_buffer)
+		return -1;
+
 	int ret = port_send(event_thread->port, dest, sk_buffer);
-	if(ret == -1)
+	if(ret != 1)
+		sk_buffer_destroy(sk_buffer);
+		
+	return ret;
+}
+
+int event_try_send(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len)
+{
+	if(!event_thread || dest == PORT_UNKOWN)
+		return -1;
+
+	sk_buffer_t *sk_buffer = event_pack(event_thread, dest, event, buffer, buffer_len);
+	if(!sk_buffer)
+		return -1;
+
+	int ret = port_try_send(event_thread->port, dest, sk_buffer);
+	if(ret != 1)
 		sk_buffer_destroy(sk_buffer);
 		
+	return ret;
+}
+
+int event_send_batch(event_thread_t *event_thread, event_batch_t *batch, int len)
+{
+	if(!event_thread || !batch || len <= 0)
+		return -1;
+
+	unsigned short *dest = (unsigned short *)calloc(len, sizeof(unsigned short));
+	struct list_head *list = (struct list_head *)calloc(len, sizeof(struct list_head));
+	if(!dest || !list)
+	{
+		free(dest);
+		free(list);
+		return -1;
+	}
+
+	int dest_len = 0;
+	for(int i = 0; i < len; i++)
+	{
+		if(batch[i].dest == PORT_UNKOWN || batch[i].dest == PORT_BROADCAST)
+			continue;
+
+		sk_buffer_t *sk_buffer = event_pack(event_thread, batch[i].dest, batch[i].event, batch[i].buffer, batch[i].buffer_len);
+		if(!sk_buffer)
+			continue;
+
+		int j = 0;
+		while(j < dest_len && dest[j] != batch[i].dest)
+			j++;
+		if(j == dest_len)
+		{
+			dest[dest_len++] = batch[i].dest;
+			INIT_LIST_HEAD(&list[j]);
+		}
+		list_add_tail(&sk_buffer->node, &list[j]);
+	}
+
+	int ret = 0;
+	for(int i = 0; i < dest_len; i++)
+	{
+		int num = port_send_list(event_thread->port, dest[i], &list[i]);
+		if(num > 0)
+			ret += num;
+
+		sk_buffer_t *sk_buffer = NULL, *next = NULL;
+		list_for_each_entry_safe(sk_buffer, next, &list[i], node)
+		{
+			list_del(&sk_buffer->node);
+			sk_buffer_destroy(sk_buffer);
+		}
+	}
+
+	free(dest);
+	free(list);
+
+	return ret;
+}
+
+static int event_call2(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len, event_rpc_t *rpc, int timeout)
+{
+	sk_buffer_t *sk_buffer = sk_buffer_create(HEADROOM_SIZE, buffer_len, TAILROOM_SIZE);
+	if(!sk_buffer)
+		return -1;
+
+	sk_buffer_data_copy(sk_buffer, buffer, buffer_len);
+
+	clock_gettime(CLOCK_MONOTONIC, &rpc->deadline);
+	rpc->deadline.tv_sec += timeout / 1000;
+	rpc->deadline.tv_nsec += timeout % 1000 * 1000000;
+	if(rpc->deadline.tv_nsec >= 1000000000)
+	{
+		rpc->deadline.tv_sec++;
+		rpc->deadline.tv_nsec -= 1000000000;
+	}
+
+	do
+		rpc->id = __atomic_add_fetch(&event_thread->rpc_id, 1, __ATOMIC_RELAXED);
+	while(rpc->id == 0);
+
+	event_pack3(event_thread, dest, event, sk_buffer, buffer_len, EVENT_OPTION_REQUEST, rpc->id);
+
+	pthread_mutex_lock(&event_thread->rpc_mutex);
+	event_rpc_add(event_thread, rpc);
+	pthread_mutex_unlock(&event_thread->rpc_mutex);
+
+	int ret = port_send(event_thread->port, dest, sk_buffer);
+	if(ret != 1)
+	{
+		sk_buffer_destroy(sk_buffer);
+		pthread_mutex_lock(&event_thread->rpc_mutex);
+		event_rpc_t *rpc2 = event_rpc_del(event_thread, rpc->id);
+		pthread_mutex_unlock(&event_thread->rpc_mutex);
+
+		/* a send blocked past the deadline, the timer or a reply already completed and freed the request */
+		if(!rpc2)
+			return 1;
+
+		return -1;
+	}
+
 	return 1;
 }
 
-int event_broadcast(event_thread_t *event_thread, unsigned int event, char *buffer, int buffer_len)
+int event_call(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len, char *reply, int *reply_len, int timeout)
 {
-	if(!event_thread)
+	if(!event_thread || dest == PORT_UNKOWN || dest == PORT_BROADCAST || !reply_len || timeout < 0)
+		return -1;
+
+	event_rpc_t rpc;
+	memset(&rpc, 0x00, sizeof(event_rpc_t));
+	rpc.buffer = reply;
+	rpc.buffer_len = reply_len;
+
+	pthread_condattr_t condattr;
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&rpc.cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+
+	int ret = event_call2(event_thread, dest, event, buffer, buffer_len, &rpc, timeout);
+	if(ret != 1)
+		goto exit;
+
+	pthread_mutex_lock(&event_thread->rpc_mutex);
+	while(rpc.status == 0)
+	{
+		if(pthread_cond_timedwait(&rpc.cond, &event_thread->rpc_mutex, &rpc.deadline) != 0 && rpc.status == 0)
+		{
+			hash_del(&rpc.node);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&event_thread->rpc_mutex);
+
+	ret = rpc.status;
+
+exit:
+	pthread_cond_destroy(&rpc.cond);
+
+	return ret;
+}
+
+int event_call_async(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len, event_reply_callback_t cb, void *para, int timeout)
+{
+	if(!event_thread || dest == PORT_UNKOWN || dest == PORT_BROADCAST || !cb || timeout < 0)
+		return -1;
+
+	event_rpc_t *rpc = (event_rpc_t *)calloc(1, sizeof(event_rpc_t));
+	if(!rpc)
+		return -1;
+
+	rpc->cb = cb;
+	rpc->para = para;
+
+	int ret = event_call2(event_thread, dest, event, buffer, buffer_len, rpc, timeout);
+	if(ret != 1)
+		free(rpc);
+
+	return ret;
+}
+
+int event_reply(event_thread_t *event_thread, char *buffer, int buffer_len)
+{
+	if(!event_thread || event_rpc_id == 0)
 		return -1;
 
 	sk_buffer_t *sk_buffer = sk_buffer_create(HEADROOM_SIZE, buffer_len, TAILROOM_SIZE);
@@ -364,15 +1381,122 @@ int event_broadcast(event_thread_t *event_thread, unsigned int event, char *buff
 		return -1;
 
 	sk_buffer_data_copy(sk_buffer, buffer, buffer_len);
-    sk_buffer_push_copy(sk_buffer, (char *)&buffer_len, 4);
-	sk_buffer_push_copy(sk_buffer, (char *)&event, 4);
-	unsigned short dest = PORT_BROADCAST;
-	sk_buffer_push_copy(sk_buffer, (char *)&dest, 2);
-	sk_buffer_push_copy(sk_buffer, (char *)&event_thread->id, 2);
-	XXH32_hash_t hash = XXH32(sk_buffer->data, sk_buffer->tail - sk_buffer->data, 0);
-	sk_buffer_push_copy(sk_buffer, (char *)&hash, 4);
+	event_pack3(event_thread, event_rpc_source, event_rpc_event, sk_buffer, buffer_len, EVENT_OPTION_RESPONSE, event_rpc_id);
+
+	int ret = port_send(event_thread->port, event_rpc_source, sk_buffer);
+	if(ret != 1)
+		sk_buffer_destroy(sk_buffer);
+
+	return ret;
+}
+
+/* dest and event wait in the headroom at the place event_pack2 writes them again on commit */
+char *event_loan(event_thread_t *event_thread, unsigned short dest, unsigned int event, int size)
+{
+	if(!event_thread || dest == PORT_UNKOWN || size < 0)
+		return NULL;
+
+	sk_buffer_t *sk_buffer = sk_buffer_create(HEADROOM_SIZE, size, TAILROOM_SIZE);
+	if(!sk_buffer)
+		return NULL;
+
+	memcpy(sk_buffer->data - 14, &dest, 2);
+	memcpy(sk_buffer->data - 8, &event, 4);
+
+	return sk_buffer->data;
+}
+
+static sk_buffer_t *event_loan_get(char *buffer)
+{
+	return (sk_buffer_t *)(buffer - HEADROOM_SIZE - offsetof(sk_buffer_t, buffer));
+}
+
+int event_commit(event_thread_t *event_thread, char *buffer, int buffer_len)
+{
+	if(!buffer)
+		return -1;
+
+	sk_buffer_t *sk_buffer = event_loan_get(buffer);
+	if(!event_thread || buffer_len < 0 || buffer_len > sk_buffer->tail - sk_buffer->data)
+	{
+		sk_buffer_destroy(sk_buffer);
+		return -1;
+	}
+
+	unsigned short dest = 0;
+	unsigned int event = 0;
+	memcpy(&dest, sk_buffer->data - 14, 2);
+	memcpy(&event, sk_buffer->data - 8, 4);
+
+	sk_buffer->tail = sk_buffer->data + buffer_len;
+	event_pack2(event_thread, dest, event, sk_buffer, buffer_len);
+
+	if(dest == PORT_BROADCAST)
+	{
+		port_multicast(event_thread->port, event, sk_buffer);
+		sk_buffer_destroy(sk_buffer);
+		return 1;
+	}
+
+	int ret = port_send(event_thread->port, dest, sk_buffer);
+	if(ret != 1)
+		sk_buffer_destroy(sk_buffer);
+
+	return ret;
+}
+
+int event_cancel(event_thread_t *event_thread, char *buffer)
+{
+	if(!buffer)
+		return -1;
+
+	sk_buffer_destroy(event_loan_get(buffer));
+
+	return 1;
+}
+
+int event_send_ext(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len, sk_buffer_release_t release, void *para)
+{
+	if(!event_thread || dest == PORT_UNKOWN || dest == PORT_BROADCAST)
+		goto exit;
+
+	sk_buffer_t *frag = sk_buffer_create_ext(buffer, buffer_len, release, para);
+	if(!frag)
+		goto exit;
+
+	sk_buffer_t *sk_buffer = sk_buffer_create(HEADROOM_SIZE, 0, TAILROOM_SIZE);
+	if(!sk_buffer)
+	{
+		sk_buffer_destroy(frag);
+		return -1;
+	}
+
+	sk_buffer_add_frag(sk_buffer, frag);
+	event_pack2(event_thread, dest, event, sk_buffer, buffer_len);
+
+	int ret = port_send(event_thread->port, dest, sk_buffer);
+	if(ret != 1)
+		sk_buffer_destroy(sk_buffer);
+
+	return ret;
+
+exit:
+	if(release)
+		release(para);
+
+	return -1;
+}
+
+int event_broadcast(event_thread_t *event_thread, unsigned int event, char *buffer, int buffer_len)
+{
+	if(!event_thread)
+		return -1;
+
+	sk_buffer_t *sk_buffer = event_pack(event_thread, PORT_BROADCAST, event, buffer, buffer_len);
+	if(!sk_buffer)
+		return -1;
 	
-	port_broadcast(event_thread->port, sk_buffer);
+	port_multicast(event_thread->port, event, sk_buffer);
 	sk_buffer_destroy(sk_buffer);
 
 	return 1;
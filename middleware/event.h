@@ -9,31 +9,141 @@ extern "C"
 #endif
 
 #include <semaphore.h>
+#include "rcu.h"
+#include "hashtable.h"
+#include "timer2.h"
+#include "thread2.h"
 #include "port.h"
 
+#define EVENT_DIRECT_LEN 10000
+#define EVENT_HASH_LEN 256
+#define EVENT_HASH_INDEX(event) ((event) & (EVENT_HASH_LEN - 1))
+#define EVENT_WORKER_MAX 64
+/* handlers of one message copied on the stack before they run, more take an allocation */
+#define EVENT_HANDLER_STACK 16
+
+/* option bits above the priority, a 4 byte correlation id follows the length field when either is set */
+#define EVENT_OPTION_REQUEST 0x100
+#define EVENT_OPTION_RESPONSE 0x200
+#define EVENT_RPC_LEN 256
+/* ms a stopping thread, then each of its workers, keeps handling queued messages before the rest is dropped */
+#define EVENT_DRAIN_TIME 100
+
 typedef struct event_thread event_thread_t;
 
 typedef int (*event_callback_t)(event_thread_t *event_thread, void *para, unsigned short source_id, unsigned int event, char *buffer, int buffer_len);
 
+typedef unsigned int (*event_key_t)(void *para, unsigned short source_id, unsigned int event);
+
+/* status is 1 when the reply arrived, 0 when the request timed out with buffer NULL */
+typedef int (*event_reply_callback_t)(event_thread_t *event_thread, void *para, int status, char *buffer, int buffer_len);
+
+/* one outstanding request, hashed by its correlation id */
+typedef struct
+{
+	unsigned int id;
+	struct timespec deadline;
+	event_reply_callback_t cb;
+	void *para;
+	pthread_cond_t cond;
+	int status;
+	char *buffer;
+	int *buffer_len;
+	struct hlist_node node;
+} event_rpc_t;
+
+typedef struct
+{
+	unsigned short dest;
+	unsigned int event;
+	char *buffer;
+	int buffer_len;
+} event_batch_t;
+
+/* a handler picked for one message */
+typedef struct
+{
+	event_callback_t cb;
+	void *para;
+} event_handler_t;
+
+/* one subscription, event equals last for a single id */
 typedef struct
 {
 	unsigned int event;
+	unsigned int last;
 	event_callback_t cb;
 	void *para;
 	struct list_head node;
+	struct rcu_head rcu;
 } event_t;
 
+/* immutable list of the events of one hash bucket, replaced as a whole on attach and detach */
+typedef struct
+{
+	struct rcu_head rcu;
+	int len;
+	event_t *event[0];
+} event_bucket_t;
+
+/* immutable handlers of the ids event to last in attach order, either those of one direct id or of one span of ranges */
+typedef struct
+{
+	struct rcu_head rcu;
+	unsigned int event;
+	unsigned int last;
+	int len;
+	event_t *handler[0];
+} event_set_t;
+
+/* disjoint spans of all ranges, direct ids included, sorted by id and sharing one set per span */
+typedef struct
+{
+	struct rcu_head rcu;
+	int len;
+	event_set_t *set[0];
+} event_range_t;
+
+typedef struct
+{
+	event_thread_t *event_thread;
+	pthread_t pthread;
+	queue_t queue;
+} event_worker_t;
+
 struct event_thread
 {
 	struct list_head node;
 	unsigned short id;
+	unsigned char priority;
 	port_t *port;
 	pthread_t pthread;
+	thread2_attr_t attr;
+	char is_start;
+	char is_poll;
+	char is_trace;
 	sem_t port_sem;
 	struct list_head event_node;
 	pthread_mutex_t event_node_mutex;
+	event_set_t **event_direct;
+	event_bucket_t *event_hash[EVENT_HASH_LEN];
+	event_range_t *event_range;
+	int worker_len;
+	event_worker_t *worker;
+	event_key_t key;
+	void *key_para;
+	int conflate_len;
+	unsigned int *conflate;
+	unsigned int rpc_id;
+	pthread_mutex_t rpc_mutex;
+	struct hlist_head rpc[EVENT_RPC_LEN];
+	/* asynchronous requests outstanding, rpc_timer is armed for the nearest deadline only while there are some */
+	int rpc_async;
+	struct timespec rpc_deadline;
+	timer2_t rpc_timer;
 };
 
+/* priority is carried by every message this thread sends, higher priorities are received first */
 int event_thread_init(event_thread_t *event_thread, unsigned short id, unsigned char priority);
 
 int event_thread_exit(event_thread_t *event_thread);
@@ -42,16 +152,130 @@ event_thread_t *event_thread_create(unsigned short id, unsigned char priority);
 
 int event_thread_destroy(event_thread_t *event_thread);
 
+/*
+ * attaching joins the port to the group of event, so broadcasts of event reach this thread.
+ * Several handlers may be attached to one event, attaching the same cb and para twice is a no-op.
+ * Callbacks run without any lock held, so attach and detach may be called from inside them.
+ */
 int event_thread_attach_event(event_thread_t *event_thread, unsigned int event, event_callback_t cb, void *para);
 
+/* removes every handler attached to exactly event, a message already being dispatched on another thread may still run them */
 int event_thread_detach_event(event_thread_t *event_thread, unsigned int event);
 
+/*
+ * attaches cb to every id from event to last. Handlers of a single id run before range handlers.
+ * Broadcasts in the range reach the thread from other processes as well, gateways advertise the range.
+ */
+int event_thread_attach_event_range(event_thread_t *event_thread, unsigned int event, unsigned int last, event_callback_t cb, void *para);
+
+/* removes the handlers attached to exactly event to last with cb and para, or all of them when cb is NULL */
+int event_thread_detach_event_range(event_thread_t *event_thread, unsigned int event, unsigned int last, event_callback_t cb, void *para);
+
+/*
+ * called from inside an event callback, keeps the buffer passed to the callback valid
+ * after it returns. The returned sk_buffer has data pointing at that buffer, hand it to
+ * another thread and call event_release once done with it. Hold buffers are read-only.
+ */
+sk_buffer_t *event_hold(event_thread_t *event_thread);
+
+int event_release(sk_buffer_t *sk_buffer);
+
+/*
+ * called before start, hands received messages to num worker threads. Messages with the same key
+ * are handled in order by the same worker, key NULL keys by source and event. Callbacks then run
+ * concurrently and event_thread_attach_event may be called from any of them.
+ */
+int event_thread_set_worker(event_thread_t *event_thread, int num, event_key_t key, void *para);
+
+/*
+ * called before start, only the newest message of event from each source is kept waiting in the queue,
+ * older ones still queued are dropped. Requests and responses are never dropped.
+ */
+int event_thread_set_conflate(event_thread_t *event_thread, unsigned int event);
+
+/* called before start, sets the scheduling of the event thread and its workers */
+int event_thread_set_attr(event_thread_t *event_thread, thread2_attr_t *attr);
+
+/*
+ * called before start, the event thread polls its queue for up to max us before it sleeps,
+ * trading cpu time for latency. Pays off when senders run on other cpus, see port_set_spin.
+ * Under a real-time policy, the default attr, it polls PORT_SPIN_RT_MAX us at most.
+ */
+int event_thread_set_spin(event_thread_t *event_thread, int max);
+
+/* called before start, how the messages this thread sends and receives are hashed and checked, see port_set_integrity */
+int event_thread_set_integrity(event_thread_t *event_thread, char integrity);
+
+/*
+ * messages this thread sends to one dest carry a trace, which every hop stamps and the receiving
+ * process adds to its statistics on dispatch, see trace_print. Broadcasts are never traced.
+ */
+int event_thread_set_trace(event_thread_t *event_thread, char is_trace);
+
+/* may be called again after event_thread_stop */
 int event_thread_start(event_thread_t *event_thread);
 
+/*
+ * refuses new messages, lets the threads handle what is already queued for up to EVENT_DRAIN_TIME ms,
+ * then joins them and drops what is left. Returns once no callback of this thread runs anymore.
+ */
 int event_thread_stop(event_thread_t *event_thread);
 
+/*
+ * instead of event_thread_start, lets an existing loop drive the thread. Returns a file descriptor
+ * that polls readable while messages wait, call event_thread_dispatch then. Workers are not used.
+ */
+int event_thread_get_fd(event_thread_t *event_thread);
+
+/* handles up to max waiting messages in the calling thread without blocking, returns the number handled */
+int event_thread_dispatch(event_thread_t *event_thread, int max);
+
 int event_send(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len);
 
+/* returns 0 instead of waiting when the queue towards dest is full, nothing is queued in that case */
+int event_try_send(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len);
+
+/*
+ * sends the len messages of batch, the messages to one dest are queued together with one lock
+ * and one wakeup and keep their order. Returns the number of messages queued.
+ */
+int event_send_batch(event_thread_t *event_thread, event_batch_t *batch, int len);
+
+/*
+ * returns size writable bytes with room for the header in front, for a message of event to dest.
+ * Fill them and hand the pointer to event_commit, which sends it without copying, or to event_cancel.
+ */
+char *event_loan(event_thread_t *event_thread, unsigned short dest, unsigned int event, int size);
+
+/* sends the first buffer_len bytes of a loan, dest may be PORT_BROADCAST. The loan is gone afterwards, also on failure */
+int event_commit(event_thread_t *event_thread, char *buffer, int buffer_len);
+
+int event_cancel(event_thread_t *event_thread, char *buffer);
+
+/*
+ * sends buffer without copying it, the header goes in front as a separate fragment.
+ * buffer must stay unchanged until release is called, which happens exactly once,
+ * also when sending fails. Transports gather the fragments instead of flattening them.
+ */
+int event_send_ext(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len, sk_buffer_release_t release, void *para);
+
+/*
+ * sends a request and waits up to timeout ms for the reply, which is copied to reply.
+ * reply_len holds the size of reply and receives the length of the reply.
+ * Returns 1 on reply, 0 on timeout. Do not call it from a callback of the same thread unless it has workers.
+ */
+int event_call(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len, char *reply, int *reply_len, int timeout);
+
+/*
+ * sends a request, cb runs on the event thread when the reply arrives or on the timer thread after timeout ms.
+ * Returns 1 when cb runs exactly once, also when it already ran while sending blocked, -1 when it never runs.
+ */
+int event_call_async(event_thread_t *event_thread, unsigned short dest, unsigned int event, char *buffer, int buffer_len, event_reply_callback_t cb, void *para, int timeout);
+
+/* called from inside the callback of a request, answers it */
+int event_reply(event_thread_t *event_thread, char *buffer, int buffer_len);
+
+/* delivers to the threads that attached event, in this process and behind other gateways */
 int event_broadcast(event_thread_t *event_thread, unsigned int event, char *buffer, int buffer_len);
 
 #ifdef __cplusplus
@@ -4,24 +4,732 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sched.h>
+#include <time.h>
 #include "kernel.h"
 #include "xxhash.h"
 #include "util.h"
 #include "sk_buffer.h"
+#include "trace.h"
 #include "gateway.h"
 
+static gateway_group_t *gateway_group_get(gateway_t *gateway, unsigned int group, unsigned short peer, char *is_first)
+{
+	*is_first = 1;
+
+	gateway_group_t *link = NULL;
+	hash_for_each_possible(gateway->group, GATEWAY_GROUP_LEN, link, node, group)
+	{
+		if(link->group != group)
+			continue;
+
+		*is_first = 0;
+		if(link->peer == peer)
+			return link;
+	}
+
+	return NULL;
+}
+
 static int gateway_broadcast_callback(port_t *port, sk_buffer_t *sk_buffer)
 {
 	if(!port || !sk_buffer)
 		return -1;
 	
 	gateway_t *gateway = (gateway_t *)port_get_p(port);
-	if(!gateway)
+	if(!gateway || !gateway->middleware_ops || !gateway->middleware_ops->send)
 		return -1;
-	
-	if(gateway->middleware_ops)
+
+	if(sk_buffer->tail - sk_buffer->data < 16)
+		return -1;
+
+	unsigned int group = *(unsigned int *)(sk_buffer->data + 12);
+
+	pthread_mutex_lock(&gateway->group_mutex);
+
+	gateway_group_t *link = NULL;
+	hash_for_each_possible(gateway->group, GATEWAY_GROUP_LEN, link, node, group)
+		if(link->group == group)
+			gateway->middleware_ops->send(gateway->middleware_ops, link->peer, sk_buffer);
+
+	/* the ranges of one peer are merged, so only a single id of the same peer can have sent it already */
+	hlist_for_each_entry(link, &gateway->range, node)
+	{
+		if(group < link->group || group > link->last)
+			continue;
+
+		char is_first = 0;
+		if(!gateway_group_get(gateway, group, link->peer, &is_first))
+			gateway->middleware_ops->send(gateway->middleware_ops, link->peer, sk_buffer);
+	}
+
+	pthread_mutex_unlock(&gateway->group_mutex);
+
+	return 1;
+}
+
+static sk_buffer_t *gateway_pack(gateway_t *gateway, unsigned short dest, unsigned int event, char *buffer, int buffer_len)
+{
+	sk_buffer_t *sk_buffer = sk_buffer_create(HEADROOM_SIZE, buffer_len, TAILROOM_SIZE);
+	if(!sk_buffer)
+		return NULL;
+
+	unsigned int option = GATEWAY_PRIORITY;
+	if(port_get_integrity(gateway->port) != PORT_INTEGRITY_NONE)
+		option |= PORT_OPTION_HASH | (checksum_get_default() << PORT_OPTION_CHECKSUM_SHIFT);
+	sk_buffer->priority = PORT_OPTION_PRIORITY(option);
+	sk_buffer_data_copy(sk_buffer, buffer, buffer_len);
+	sk_buffer_push_copy(sk_buffer, (char *)&buffer_len, 4);
+	sk_buffer_push_copy(sk_buffer, (char *)&event, 4);
+	sk_buffer_push_copy(sk_buffer, (char *)&option, 4);
+	sk_buffer_push_copy(sk_buffer, (char *)&dest, 2);
+	sk_buffer_push_copy(sk_buffer, (char *)&gateway->id, 2);
+	unsigned int hash = (option & PORT_OPTION_HASH) ? sk_buffer_hash(sk_buffer, PORT_OPTION_CHECKSUM(option)) : 0;
+	sk_buffer_push_copy(sk_buffer, (char *)&hash, 4);
+
+	return sk_buffer;
+}
+
+static int gateway_route_send(gateway_t *gateway, char type)
+{
+	if(!gateway || !gateway->middleware_ops || !gateway->middleware_ops->send)
+		return -1;
+
+	char is_local[PORT_FIB_LEN];
+	port_get_local(is_local);
+
+	char buffer[4 + PORT_FIB_LEN * 2];
+	unsigned short num = 0;
+	for(int i = 0; i < PORT_FIB_LEN; i++)
+	{
+		if(is_local[i])
+		{
+			*(unsigned short *)(buffer + 4 + num * 2) = i;
+			num++;
+		}
+	}
+
+	buffer[0] = type;
+	buffer[1] = 0;
+	*(unsigned short *)(buffer + 2) = num;
+	int buffer_len = 4 + num * 2;
+
+	sk_buffer_t *sk_buffer = gateway_pack(gateway, PORT_BROADCAST, GATEWAY_EVENT_ROUTE, buffer, buffer_len);
+	if(!sk_buffer)
+		return -1;
+
+	gateway->middleware_ops->send(gateway->middleware_ops, PORT_BROADCAST, sk_buffer);
+	sk_buffer_destroy(sk_buffer);
+
+	return 1;
+}
+
+static void gateway_route_del(gateway_t *gateway, int index)
+{
+	gateway->route[index].next = PORT_UNKOWN;
+	gateway->route[index].age = 0;
+	port_del_route(gateway->port, (index << 7) | 1);
+}
+
+static int gateway_route_recv(gateway_t *gateway, unsigned short source, char *buffer, int buffer_len)
+{
+	if(!gateway || !buffer || buffer_len < 4)
+		return -1;
+
+	char type = buffer[0];
+	unsigned short num = *(unsigned short *)(buffer + 2);
+	if(4 + num * 2 > buffer_len)
+		return -1;
+
+	char is_local[PORT_FIB_LEN];
+	port_get_local(is_local);
+
+	char is_advert[PORT_FIB_LEN];
+	memset(is_advert, 0x00, sizeof(is_advert));
+
+	char is_new = 1;
+
+	pthread_mutex_lock(&gateway->route_mutex);
+
+	for(int i = 0; i < PORT_FIB_LEN; i++)
+	{
+		if(gateway->route[i].next == source)
+		{
+			is_new = 0;
+			break;
+		}
+	}
+
+	if(type == GATEWAY_ROUTE_ADVERT)
+	{
+		for(int i = 0; i < num; i++)
+		{
+			unsigned short index = *(unsigned short *)(buffer + 4 + i * 2);
+			if(index >= PORT_FIB_LEN || is_local[index])
+				continue;
+
+			is_advert[index] = 1;
+			gateway->route[index].age = 0;
+			if(gateway->route[index].next != source)
+			{
+				gateway->route[index].next = source;
+				port_add_route(gateway->port, (index << 7) | 1, source);
+			}
+		}
+	}
+
+	for(int i = 0; i < PORT_FIB_LEN; i++)
+		if(gateway->route[i].next == source && !is_advert[i])
+			gateway_route_del(gateway, i);
+
+	pthread_mutex_unlock(&gateway->route_mutex);
+
+	if(type == GATEWAY_ROUTE_ADVERT && is_new)
+		gateway_route_send(gateway, GATEWAY_ROUTE_ADVERT);
+
+	return 1;
+}
+
+static int gateway_group_send(gateway_t *gateway, char is_withdraw)
+{
+	if(!gateway || !gateway->middleware_ops || !gateway->middleware_ops->send)
+		return -1;
+
+	int num = 0, range_num = 0;
+	if(!is_withdraw)
+	{
+		num = port_get_group(gateway->port, NULL, 0);
+		range_num = port_get_range(gateway->port, NULL, 0);
+	}
+	if(num < 0 || range_num < 0)
+		return -1;
+
+	/* the ranges follow the single ids, peers that predate them ignore the tail */
+	char *buffer = (char *)calloc(1, 4 + num * 4 + 4 + range_num * 8);
+	if(!buffer)
+		return -1;
+
+	if(num > 0)
+	{
+		int num2 = port_get_group(gateway->port, (unsigned int *)(buffer + 4), num);
+		if(num2 < num)
+			num = num2;
+	}
+	*(unsigned int *)buffer = num;
+
+	char *range = buffer + 4 + num * 4;
+	if(range_num > 0)
+	{
+		int num2 = port_get_range(gateway->port, (unsigned int *)(range + 4), range_num);
+		if(num2 < range_num)
+			range_num = num2;
+	}
+	*(unsigned int *)range = range_num;
+
+	sk_buffer_t *sk_buffer = gateway_pack(gateway, PORT_BROADCAST, GATEWAY_EVENT_GROUP, buffer, 4 + num * 4 + 4 + range_num * 8);
+	free(buffer);
+	if(!sk_buffer)
+		return -1;
+
+	gateway->middleware_ops->send(gateway->middleware_ops, PORT_BROADCAST, sk_buffer);
+	sk_buffer_destroy(sk_buffer);
+
+	return 1;
+}
+
+static void gateway_group_del(gateway_t *gateway, gateway_group_t *group)
+{
+	unsigned int group2 = group->group;
+
+	hash_del(&group->node);
+	free(group);
+
+	char is_last = 0;
+	gateway_group_get(gateway, group2, PORT_UNKOWN, &is_last);
+	if(is_last)
+		port_leave(gateway->port, group2);
+}
+
+/* range joins are counted, so every range of every peer holds one */
+static void gateway_range_del(gateway_t *gateway, gateway_group_t *range)
+{
+	hlist_del(&range->node);
+	port_leave_range(gateway->port, range->group, range->last);
+	free(range);
+}
+
+static int gateway_range_cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* sorts the first and last pairs of range and merges the overlapping ones, returns the number left */
+static int gateway_range_merge(unsigned int *range, int num)
+{
+	qsort(range, num, 8, gateway_range_cmp);
+
+	int len = 0;
+	for(int i = 0; i < num; i++)
+	{
+		unsigned int first = range[i * 2], last = range[i * 2 + 1];
+		if(first > last)
+			continue;
+
+		if(len > 0 && (unsigned long long)range[len * 2 - 1] + 1 >= first)
+		{
+			if(last > range[len * 2 - 1])
+				range[len * 2 - 1] = last;
+			continue;
+		}
+
+		range[len * 2] = first;
+		range[len * 2 + 1] = last;
+		len++;
+	}
+
+	return len;
+}
+
+/* the advert of a peer lists all its groups, anything of that peer not listed is dropped */
+static int gateway_group_recv(gateway_t *gateway, unsigned short source, char *buffer, int buffer_len)
+{
+	if(!gateway || !buffer || buffer_len < 4)
+		return -1;
+
+	unsigned int num = *(unsigned int *)buffer;
+	if(4 + (unsigned long long)num * 4 > buffer_len)
+		return -1;
+
+	unsigned int range_num = 0;
+	unsigned int *range = NULL;
+	if(8 + (unsigned long long)num * 4 <= buffer_len)
+	{
+		range_num = *(unsigned int *)(buffer + 4 + num * 4);
+		if(8 + (unsigned long long)num * 4 + (unsigned long long)range_num * 8 > buffer_len)
+			return -1;
+	}
+	if(range_num > 0)
+	{
+		range = (unsigned int *)malloc(range_num * 8);
+		if(!range)
+			return -1;
+
+		memcpy(range, buffer + 8 + num * 4, range_num * 8);
+		range_num = gateway_range_merge(range, range_num);
+	}
+
+	pthread_mutex_lock(&gateway->group_mutex);
+
+	int bkt = 0;
+	gateway_group_t *link = NULL;
+	struct hlist_node *tmp = NULL;
+	hash_for_each(gateway->group, GATEWAY_GROUP_LEN, bkt, link, node)
+		if(link->peer == source)
+			link->age = 0xFF;
+	hlist_for_each_entry(link, &gateway->range, node)
+		if(link->peer == source)
+			link->age = 0xFF;
+
+	for(int i = 0; i < num; i++)
+	{
+		unsigned int group = *(unsigned int *)(buffer + 4 + i * 4);
+
+		char is_first = 0;
+		link = gateway_group_get(gateway, group, source, &is_first);
+		if(link)
+		{
+			link->age = 0;
+			continue;
+		}
+
+		link = (gateway_group_t *)calloc(1, sizeof(gateway_group_t));
+		if(!link)
+			break;
+
+		link->group = group;
+		link->last = group;
+		link->peer = source;
+		hash_add(gateway->group, GATEWAY_GROUP_LEN, &link->node, group);
+		if(is_first)
+			port_join(gateway->port, group);
+	}
+
+	for(int i = 0; i < range_num; i++)
+	{
+		unsigned int first = range[i * 2], last = range[i * 2 + 1];
+
+		gateway_group_t *link2 = NULL;
+		hlist_for_each_entry(link, &gateway->range, node)
+		{
+			if(link->peer == source && link->group == first && link->last == last)
+			{
+				link2 = link;
+				break;
+			}
+		}
+		if(link2)
+		{
+			link2->age = 0;
+			continue;
+		}
+
+		link = (gateway_group_t *)calloc(1, sizeof(gateway_group_t));
+		if(!link)
+			break;
+
+		link->group = first;
+		link->last = last;
+		link->peer = source;
+		hlist_add_head(&link->node, &gateway->range);
+		port_join_range(gateway->port, first, last);
+	}
+
+	hash_for_each_safe(gateway->group, GATEWAY_GROUP_LEN, bkt, tmp, link, node)
+		if(link->peer == source && link->age == 0xFF)
+			gateway_group_del(gateway, link);
+	hlist_for_each_entry_safe(link, tmp, &gateway->range, node)
+		if(link->peer == source && link->age == 0xFF)
+			gateway_range_del(gateway, link);
+
+	pthread_mutex_unlock(&gateway->group_mutex);
+
+	free(range);
+
+	return 1;
+}
+
+static gateway_credit_t *gateway_credit_get(gateway_t *gateway, unsigned short id)
+{
+	gateway_credit_t *link = NULL;
+	hash_for_each_possible(gateway->credit, GATEWAY_CREDIT_LEN, link, node, id)
+		if(link->id == id)
+			return link;
+
+	link = (gateway_credit_t *)calloc(1, sizeof(gateway_credit_t));
+	if(!link)
+		return NULL;
+
+	link->id = id;
+	link->credit = GATEWAY_CREDIT_WINDOW;
+	INIT_LIST_HEAD(&link->backlog);
+	hash_add(gateway->credit, GATEWAY_CREDIT_LEN, &link->node, id);
+
+	return link;
+}
+
+/* called with credit_mutex held, sends parked messages while credit lasts, dropping the mutex around each send */
+static void gateway_credit_drain2(gateway_t *gateway, gateway_credit_t *credit)
+{
+	/* another thread is sending them, it rechecks the credit after each */
+	if(credit->is_drain)
+		return;
+
+	credit->is_drain = 1;
+	while(credit->credit > 0 && !list_empty(&credit->backlog))
+	{
+		sk_buffer_t *sk_buffer = list_first_entry(&credit->backlog, sk_buffer_t, node);
+		list_del(&sk_buffer->node);
+		credit->backlog_len--;
+		credit->credit--;
+		credit->probe_sent++;
+		pthread_mutex_unlock(&gateway->credit_mutex);
+
+		trace_stamp(sk_buffer, TRACE_MIDDLEWARE);
 		if(gateway->middleware_ops->send)
-			gateway->middleware_ops->send(gateway->middleware_ops, PORT_BROADCAST, sk_buffer);
+			gateway->middleware_ops->send(gateway->middleware_ops, credit->id, sk_buffer);
+		sk_buffer_destroy(sk_buffer);
+
+		pthread_mutex_lock(&gateway->credit_mutex);
+	}
+	credit->is_drain = 0;
+
+	pthread_cond_broadcast(&gateway->credit_cond);
+}
+
+/*
+ * send to next when it has credit and nothing parked before, park otherwise so that a slow peer only holds back
+ * its own messages. A full backlog waits up to GATEWAY_CREDIT_TIMEOUT for room, a stalled peer drops. Takes over sk_buffer.
+ */
+static void gateway_credit_send2(gateway_t *gateway, unsigned short next, sk_buffer_t *sk_buffer)
+{
+	pthread_mutex_lock(&gateway->credit_mutex);
+
+	gateway_credit_t *credit = gateway_credit_get(gateway, next);
+	if(credit && (credit->credit <= 0 || credit->is_drain || !list_empty(&credit->backlog)))
+	{
+		if(credit->backlog_len >= GATEWAY_CREDIT_BACKLOG && !credit->is_stall)
+		{
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_sec += GATEWAY_CREDIT_TIMEOUT / 1000;
+			ts.tv_nsec += (GATEWAY_CREDIT_TIMEOUT % 1000) * 1000000;
+			if(ts.tv_nsec >= 1000000000)
+			{
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+
+			while(credit->backlog_len >= GATEWAY_CREDIT_BACKLOG && !credit->is_stall)
+				if(pthread_cond_timedwait(&gateway->credit_cond, &gateway->credit_mutex, &ts) != 0)
+					break;
+		}
+
+		if(credit->backlog_len >= GATEWAY_CREDIT_BACKLOG)
+		{
+			gateway->stat.credit_drop++;
+			pthread_mutex_unlock(&gateway->credit_mutex);
+			sk_buffer_destroy(sk_buffer);
+			return;
+		}
+
+		gateway->stat.credit_wait++;
+		list_add_tail(&sk_buffer->node, &credit->backlog);
+		credit->backlog_len++;
+		pthread_mutex_unlock(&gateway->credit_mutex);
+		return;
+	}
+
+	if(credit)
+	{
+		credit->credit--;
+		credit->probe_sent++;
+	}
+
+	pthread_mutex_unlock(&gateway->credit_mutex);
+
+	trace_stamp(sk_buffer, TRACE_MIDDLEWARE);
+	if(gateway->middleware_ops->send)
+		gateway->middleware_ops->send(gateway->middleware_ops, next, sk_buffer);
+	sk_buffer_destroy(sk_buffer);
+}
+
+static void gateway_credit_add(gateway_t *gateway, unsigned short id, int num)
+{
+	pthread_mutex_lock(&gateway->credit_mutex);
+
+	gateway_credit_t *credit = gateway_credit_get(gateway, id);
+	if(credit)
+	{
+		credit->credit += num;
+		if(credit->credit > GATEWAY_CREDIT_WINDOW)
+			credit->credit = GATEWAY_CREDIT_WINDOW;
+		credit->age = 0;
+		credit->is_stall = 0;
+		gateway_credit_drain2(gateway, credit);
+	}
+
+	pthread_mutex_unlock(&gateway->credit_mutex);
+}
+
+/*
+ * the answer of id to probe: everything sent before the probe is delivered, dropped or among
+ * the queue messages still queued there, so the window is what is left after those and the messages sent since.
+ */
+static void gateway_credit_sync(gateway_t *gateway, unsigned short id, unsigned int probe, int queue)
+{
+	pthread_mutex_lock(&gateway->credit_mutex);
+
+	gateway_credit_t *credit = gateway_credit_get(gateway, id);
+	if(credit && credit->probe == probe)
+	{
+		credit->credit = GATEWAY_CREDIT_WINDOW - queue - credit->probe_sent;
+		if(credit->credit > GATEWAY_CREDIT_WINDOW)
+			credit->credit = GATEWAY_CREDIT_WINDOW;
+		credit->age = 0;
+		credit->is_stall = 0;
+		gateway_credit_drain2(gateway, credit);
+	}
+
+	pthread_mutex_unlock(&gateway->credit_mutex);
+}
+
+/* answer the probe of prev with how many of its messages are still queued, the credit not yet returned is part of that answer */
+static void gateway_credit_probe_recv(gateway_t *gateway, unsigned short prev, unsigned int probe)
+{
+	unsigned int buffer[3] = {0, probe, 0};
+
+	pthread_mutex_lock(&gateway->credit_mutex);
+
+	gateway_credit_t *credit = gateway_credit_get(gateway, prev);
+	if(credit)
+	{
+		buffer[2] = credit->queue;
+		credit->ack = 0;
+	}
+
+	pthread_mutex_unlock(&gateway->credit_mutex);
+
+	if(!credit || !gateway->middleware_ops->send)
+		return;
+
+	sk_buffer_t *sk_buffer = gateway_pack(gateway, prev, GATEWAY_EVENT_CREDIT, (char *)buffer, sizeof(buffer));
+	if(!sk_buffer)
+		return;
+
+	gateway->middleware_ops->send(gateway->middleware_ops, prev, sk_buffer);
+	sk_buffer_destroy(sk_buffer);
+}
+
+/*
+ * called every route interval, a peer that left messages parked for GATEWAY_CREDIT_TIMEOUT is probed and gets
+ * a single message through, rather than a refilled window that a stalled peer would only drop.
+ */
+static void gateway_credit_timer2(gateway_t *gateway)
+{
+	pthread_mutex_lock(&gateway->credit_mutex);
+
+	int bkt = 0;
+	gateway_credit_t *credit = NULL;
+	hash_for_each(gateway->credit, GATEWAY_CREDIT_LEN, bkt, credit, node)
+	{
+		if(list_empty(&credit->backlog) || ++credit->age < GATEWAY_CREDIT_TIMEOUT / GATEWAY_ROUTE_INTERVAL)
+			continue;
+
+		gateway->stat.credit_timeout++;
+		credit->age = 0;
+		credit->is_stall = 1;
+		credit->probe++;
+		credit->probe_sent = 0;
+		unsigned int buffer[2] = {0, credit->probe};
+		sk_buffer_t *sk_buffer = gateway_pack(gateway, credit->id, GATEWAY_EVENT_CREDIT, (char *)buffer, sizeof(buffer));
+		if(sk_buffer && gateway->middleware_ops->send)
+			gateway->middleware_ops->send(gateway->middleware_ops, credit->id, sk_buffer);
+		if(sk_buffer)
+			sk_buffer_destroy(sk_buffer);
+
+		/* a peer that does not answer probes still gets one message per timeout */
+		if(credit->credit <= 0)
+			credit->credit = 1;
+		gateway_credit_drain2(gateway, credit);
+	}
+
+	pthread_mutex_unlock(&gateway->credit_mutex);
+}
+
+/* prev a message from the transport, data at the hash, counts against, PORT_UNKOWN for messages outside the credit */
+static unsigned short gateway_credit_prev2(gateway_t *gateway, char *buffer, int buffer_len)
+{
+	if(buffer_len < GATEWAY_FRAME_MIN)
+		return PORT_UNKOWN;
+
+	unsigned short source = *(unsigned short *)(buffer + 4);
+	unsigned short dest = *(unsigned short *)(buffer + 6);
+	unsigned int event = *(unsigned int *)(buffer + 12);
+	if(dest == PORT_BROADCAST || (dest == gateway->id && event == GATEWAY_EVENT_CREDIT))
+		return PORT_UNKOWN;
+
+	return port_get_next(gateway->port, source);
+}
+
+/* count a message queued from prev, it is credited back once taken off the queue */
+static void gateway_credit_queue2(gateway_t *gateway, unsigned short prev)
+{
+	pthread_mutex_lock(&gateway->credit_mutex);
+
+	gateway_credit_t *credit = gateway_credit_get(gateway, prev);
+	if(credit)
+		credit->queue++;
+
+	pthread_mutex_unlock(&gateway->credit_mutex);
+}
+
+/* count a message from prev taken off the queue and return credits once a quarter window has been consumed */
+static void gateway_credit_ack(gateway_t *gateway, unsigned short prev)
+{
+	int num = 0;
+
+	pthread_mutex_lock(&gateway->credit_mutex);
+
+	gateway_credit_t *credit = gateway_credit_get(gateway, prev);
+	if(credit)
+	{
+		if(credit->queue > 0)
+			credit->queue--;
+		credit->ack++;
+		if(credit->ack >= GATEWAY_CREDIT_WINDOW / 4)
+		{
+			num = credit->ack;
+			credit->ack = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&gateway->credit_mutex);
+
+	if(num == 0 || !gateway->middleware_ops->send)
+		return;
+
+	sk_buffer_t *sk_buffer = gateway_pack(gateway, prev, GATEWAY_EVENT_CREDIT, (char *)&num, 4);
+	if(!sk_buffer)
+		return;
+
+	gateway->middleware_ops->send(gateway->middleware_ops, prev, sk_buffer);
+	sk_buffer_destroy(sk_buffer);
+}
+
+static int gateway_group_timer(void *para)
+{
+	if(!para)
+		return -1;
+
+	gateway_t *gateway = (gateway_t *)para;
+
+	unsigned int gen = port_get_group_gen();
+	if(gen == gateway->group_gen)
+		return 1;
+
+	gateway->group_gen = gen;
+	gateway_group_send(gateway, 0);
+
+	return 1;
+}
+
+static int gateway_route_timer(void *para)
+{
+	if(!para)
+		return -1;
+
+	gateway_t *gateway = (gateway_t *)para;
+
+	pthread_mutex_lock(&gateway->route_mutex);
+
+	for(int i = 0; i < PORT_FIB_LEN; i++)
+	{
+		if(gateway->route[i].next == PORT_UNKOWN)
+			continue;
+
+		gateway->route[i].age++;
+		if(gateway->route[i].age >= GATEWAY_ROUTE_TIMEOUT)
+			gateway_route_del(gateway, i);
+	}
+
+	pthread_mutex_unlock(&gateway->route_mutex);
+
+	gateway_route_send(gateway, GATEWAY_ROUTE_ADVERT);
+
+	pthread_mutex_lock(&gateway->group_mutex);
+
+	int bkt = 0;
+	gateway_group_t *link = NULL;
+	struct hlist_node *tmp = NULL;
+	hash_for_each_safe(gateway->group, GATEWAY_GROUP_LEN, bkt, tmp, link, node)
+	{
+		link->age++;
+		if(link->age >= GATEWAY_ROUTE_TIMEOUT)
+			gateway_group_del(gateway, link);
+	}
+	hlist_for_each_entry_safe(link, tmp, &gateway->range, node)
+	{
+		link->age++;
+		if(link->age >= GATEWAY_ROUTE_TIMEOUT)
+			gateway_range_del(gateway, link);
+	}
+
+	pthread_mutex_unlock(&gateway->group_mutex);
+
+	gateway_group_send(gateway, 0);
+
+	gateway_credit_timer2(gateway);
 
 	return 1;
 }
@@ -40,7 +748,19 @@ static int recv_callback(middleware_ops_t *middleware_ops, char *buffer, int buf
 		return -1;
 
 	sk_buffer_data_copy(sk_buffer, buffer, buffer_len);
-	queue_push(&gateway->queue, &sk_buffer->node);
+	trace_stamp(sk_buffer, TRACE_RECV);
+	if(buffer_len >= 12)
+		sk_buffer->priority = PORT_OPTION_PRIORITY(*(unsigned int *)(buffer + 8));
+	unsigned short prev = gateway_credit_prev2(gateway, buffer, buffer_len);
+	if(prio_queue_try_push(&gateway->queue, &sk_buffer->node, PORT_PRIORITY_LANE(sk_buffer->priority)) != 1)
+	{
+		__atomic_add_fetch(&gateway->stat.recv_drop, 1, __ATOMIC_RELAXED);
+		sk_buffer_destroy(sk_buffer);
+		return -1;
+	}
+
+	if(prev != PORT_UNKOWN)
+		gateway_credit_queue2(gateway, prev);
 
 	return 1;
 }
@@ -52,8 +772,28 @@ int gateway_init(gateway_t *gateway, unsigned short id, char type)
 	
 	gateway->id = id;
 	gateway->type = type;
+	thread2_attr_init(&gateway->attr);
+	
+	memset(gateway->route, 0x00, sizeof(gateway->route));
+	pthread_mutex_init(&gateway->route_mutex, NULL);
+	timer2_init(&gateway->route_timer, gateway_route_timer, gateway);
+
+	hash_init(gateway->credit, GATEWAY_CREDIT_LEN);
+	pthread_mutex_init(&gateway->credit_mutex, NULL);
+	pthread_condattr_t condattr;
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&gateway->credit_cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+	memset(&gateway->stat, 0x00, sizeof(gateway->stat));
+
+	hash_init(gateway->group, GATEWAY_GROUP_LEN);
+	INIT_HLIST_HEAD(&gateway->range);
+	pthread_mutex_init(&gateway->group_mutex, NULL);
+	timer2_init(&gateway->group_timer, gateway_group_timer, gateway);
+	gateway->group_gen = 0;
 	
-	queue_init(&gateway->queue, -1);
+	prio_queue_init(&gateway->queue, GATEWAY_QUEUE_MAX, PORT_QUEUE_GUARD);
 	gateway->port = port_create(gateway->id);
 	if(!gateway->port)
 		goto exit;
@@ -82,7 +822,13 @@ exit2:
 	sem_destroy(&gateway->port_sem);
 	port_destroy(gateway->port);
 exit:
-	queue_exit(&gateway->queue);
+	prio_queue_exit(&gateway->queue);
+	timer2_exit(&gateway->group_timer);
+	pthread_mutex_destroy(&gateway->group_mutex);
+	pthread_cond_destroy(&gateway->credit_cond);
+	pthread_mutex_destroy(&gateway->credit_mutex);
+	timer2_exit(&gateway->route_timer);
+	pthread_mutex_destroy(&gateway->route_mutex);
 	
 	return -1;
 }
@@ -92,6 +838,9 @@ int gateway_exit(gateway_t *gateway)
 	if(!gateway || !gateway->port || !gateway->middleware_ops)
 		return -1;
 
+	if(gateway->is_start)
+		gateway_stop(gateway);
+
 	sem_destroy(&gateway->middleware_ops_sem);
 
 	if(gateway->middleware_ops->exit)
@@ -101,7 +850,35 @@ int gateway_exit(gateway_t *gateway)
 	sem_destroy(&gateway->port_sem);
 
 	port_destroy(gateway->port);
-	queue_exit(&gateway->queue);
+	prio_queue_exit(&gateway->queue);
+
+	int bkt = 0;
+	gateway_credit_t *link = NULL;
+	struct hlist_node *tmp = NULL;
+	hash_for_each_safe(gateway->credit, GATEWAY_CREDIT_LEN, bkt, tmp, link, node)
+	{
+		hash_del(&link->node);
+		free(link);
+	}
+	pthread_cond_destroy(&gateway->credit_cond);
+	pthread_mutex_destroy(&gateway->credit_mutex);
+
+	gateway_group_t *group = NULL;
+	hash_for_each_safe(gateway->group, GATEWAY_GROUP_LEN, bkt, tmp, group, node)
+	{
+		hash_del(&group->node);
+		free(group);
+	}
+	hlist_for_each_entry_safe(group, tmp, &gateway->range, node)
+	{
+		hlist_del(&group->node);
+		free(group);
+	}
+	timer2_exit(&gateway->group_timer);
+	pthread_mutex_destroy(&gateway->group_mutex);
+	
+	timer2_exit(&gateway->route_timer);
+	pthread_mutex_destroy(&gateway->route_mutex);
 	
 	return 1;
 }
@@ -136,6 +913,42 @@ int gateway_destroy(gateway_t *gateway)
 	return 1;
 }
 
+/*
+ * data at the source of a message entering or, with is_out, leaving through the transport.
+ * Checks hash when the integrity of the gateway asks for it, a message leaving without one gets it here.
+ */
+static int gateway_check2(gateway_t *gateway, sk_buffer_t *sk_buffer, unsigned int *hash, char is_out)
+{
+	char integrity = port_get_integrity(gateway->port);
+	unsigned int *option = (unsigned int *)(sk_buffer->data + 4);
+	if(integrity == PORT_INTEGRITY_NONE)
+		return 1;
+
+	if(!(*option & PORT_OPTION_HASH))
+	{
+		if(is_out)
+		{
+			*option = (*option & ~PORT_OPTION_CHECKSUM_MASK) | PORT_OPTION_HASH | (checksum_get_default() << PORT_OPTION_CHECKSUM_SHIFT);
+			*hash = trace_hash(sk_buffer);
+		}
+
+		return 1;
+	}
+
+	/* with EDGE a hashed message leaving the process was checked on its way in or never left memory */
+	if(is_out && integrity == PORT_INTEGRITY_EDGE)
+		return 1;
+
+	unsigned int hash2 = trace_hash(sk_buffer);
+	if(*hash != hash2)
+	{
+		printf("hash values are not equal, hash-hash2: %x-%x\n", *hash, hash2);
+		return -1;
+	}
+
+	return 1;
+}
+
 static void *port_thread(void *para)
 {
 	if(!para)
@@ -145,9 +958,6 @@ static void *port_thread(void *para)
 	if(!gateway->port || !gateway->middleware_ops)
 		return NULL;
 
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
 	port_set_state(gateway->port, PORT_STATE_CONN);
 
 	sem_post(&gateway->port_sem);
@@ -156,14 +966,14 @@ static void *port_thread(void *para)
 	{
 		sk_buffer_t *sk_buffer = port_recv(gateway->port);
 		if(!sk_buffer)
-			continue;
+			break;
+
+		trace_stamp(sk_buffer, TRACE_GATEWAY);
 
 		unsigned int hash = *(unsigned int *)sk_buffer->data;
 		sk_buffer_pull(sk_buffer, 4);
-		XXH32_hash_t hash2 = XXH32(sk_buffer->data, sk_buffer->tail - sk_buffer->data, 0);
-		if(hash != hash2)
+		if(gateway_check2(gateway, sk_buffer, &hash, 1) != 1)
 		{
-			printf("hash values are not equal, hash-hash2: %x-%x\n", hash, hash2);
 			sk_buffer_destroy(sk_buffer);
 			continue;
 		}
@@ -176,19 +986,40 @@ static void *port_thread(void *para)
 		sk_buffer_push_copy(sk_buffer, (char *)&source, 2);
 		sk_buffer_push_copy(sk_buffer, (char *)&hash, 4);
 
-		unsigned short next = port_get_next_jump(gateway->id, dest);
-		if(next != PORT_UNKOWN)
+		unsigned short next = port_get_next(gateway->port, dest);
+		if(next == PORT_UNKOWN)
 		{
-			if(gateway->middleware_ops->send)
-				gateway->middleware_ops->send(gateway->middleware_ops, next, sk_buffer);
+			sk_buffer_destroy(sk_buffer);
+			continue;
 		}
 
-		sk_buffer_destroy(sk_buffer);
+		gateway_credit_send2(gateway, next, sk_buffer);
 	}
 	
 	return NULL;
 }
 
+/* whether a frame from the transport, data at the hash, holds its header and the payload and trace its header claims */
+static int gateway_frame_check2(sk_buffer_t *sk_buffer)
+{
+	long long len = sk_buffer->tail - sk_buffer->data;
+	if(len < GATEWAY_FRAME_MIN)
+	{
+		printf("frame of %lld bytes is shorter than its header\n", len);
+		return -1;
+	}
+
+	unsigned int option = *(unsigned int *)(sk_buffer->data + 8);
+	unsigned int payload_len = *(unsigned int *)(sk_buffer->data + 16);
+	if(GATEWAY_FRAME_MIN + (long long)payload_len + ((option & TRACE_OPTION) ? TRACE_SIZE : 0) > len)
+	{
+		printf("frame of %lld bytes is shorter than its payload of %u bytes\n", len, payload_len);
+		return -1;
+	}
+
+	return 1;
+}
+
 static void *middleware_ops_thread(void *para)
 {
 	if(!para)
@@ -198,27 +1029,36 @@ static void *middleware_ops_thread(void *para)
 	if(!gateway->port || !gateway->middleware_ops)
 		return NULL;
 	
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
 	sem_post(&gateway->middleware_ops_sem);
 
 	while(1)
 	{
-		struct list_head *node = queue_pop(&gateway->queue);
+		struct list_head *node = prio_queue_pop(&gateway->queue);
 		if(!node)
-			continue;
+			break;
 		
 		sk_buffer_t *sk_buffer = container_of(node, sk_buffer_t, node);
 		if(!sk_buffer)
 			continue;
 
+		trace_stamp(sk_buffer, TRACE_OPS);
+
+		/* credit for a message comes back once it left the queue, also when it is dropped below */
+		unsigned short prev = gateway_credit_prev2(gateway, sk_buffer->data, sk_buffer->tail - sk_buffer->data);
+		if(prev != PORT_UNKOWN)
+			gateway_credit_ack(gateway, prev);
+
+		/* the length fields below come off the wire, the pulls cannot fail once the frame passed this */
+		if(gateway_frame_check2(sk_buffer) != 1)
+		{
+			sk_buffer_destroy(sk_buffer);
+			continue;
+		}
+
 		unsigned int hash = *(unsigned int *)sk_buffer->data;
 		sk_buffer_pull(sk_buffer, 4);
-		XXH32_hash_t hash2 = XXH32(sk_buffer->data, sk_buffer->tail - sk_buffer->data, 0);
-		if(hash != hash2)
+		if(gateway_check2(gateway, sk_buffer, &hash, 0) != 1)
 		{
-			printf("hash values are not equal, hash-hash2: %x-%x\n", hash, hash2);
 			sk_buffer_destroy(sk_buffer);
 			continue;
 		}
@@ -227,6 +1067,44 @@ static void *middleware_ops_thread(void *para)
 		sk_buffer_pull(sk_buffer, 2);
 		unsigned short dest = *(unsigned short *)sk_buffer->data;
 		sk_buffer_pull(sk_buffer, 2);
+
+		unsigned int option = *(unsigned int *)sk_buffer->data;
+		unsigned int event = *(unsigned int *)(sk_buffer->data + 4);
+		sk_buffer->priority = PORT_OPTION_PRIORITY(option);
+		if(dest == PORT_BROADCAST && event == GATEWAY_EVENT_ROUTE)
+		{
+			if(source != gateway->id)
+				gateway_route_recv(gateway, source, sk_buffer->data + 12, *(unsigned int *)(sk_buffer->data + 8));
+
+			sk_buffer_destroy(sk_buffer);
+			continue;
+		}
+
+		if(dest == PORT_BROADCAST && event == GATEWAY_EVENT_GROUP)
+		{
+			if(source != gateway->id)
+				gateway_group_recv(gateway, source, sk_buffer->data + 12, *(unsigned int *)(sk_buffer->data + 8));
+
+			sk_buffer_destroy(sk_buffer);
+			continue;
+		}
+
+		if(dest == gateway->id && event == GATEWAY_EVENT_CREDIT)
+		{
+			/* credit returned, a probe of source with its number, or the answer to a probe with the messages still queued */
+			unsigned int len = *(unsigned int *)(sk_buffer->data + 8);
+			unsigned int *buffer = (unsigned int *)(sk_buffer->data + 12);
+			if(len == 4)
+				gateway_credit_add(gateway, source, (int)buffer[0]);
+			else if(len == 8)
+				gateway_credit_probe_recv(gateway, source, buffer[1]);
+			else if(len == 12)
+				gateway_credit_sync(gateway, source, buffer[1], (int)buffer[2]);
+
+			sk_buffer_destroy(sk_buffer);
+			continue;
+		}
+
 		sk_buffer_push_copy(sk_buffer, (char *)&dest, 2);
 		sk_buffer_push_copy(sk_buffer, (char *)&source, 2);
 		sk_buffer_push_copy(sk_buffer, (char *)&hash, 4);
@@ -235,15 +1113,13 @@ static void *middleware_ops_thread(void *para)
 		{
 			port_t *port = port_get_by_id(source);
 			if(!port)
-			{
-				port_broadcast(gateway->port, sk_buffer);
-				sk_buffer_destroy(sk_buffer);
-			}
+				port_multicast(gateway->port, event, sk_buffer);
+			sk_buffer_destroy(sk_buffer);
 		}
 		else
 		{
 			int ret = port_send(gateway->port, dest, sk_buffer);
-			if(ret == -1)
+			if(ret != 1)
 				sk_buffer_destroy(sk_buffer);
 		}
 	}
@@ -251,53 +1127,135 @@ static void *middleware_ops_thread(void *para)
 	return NULL;
 }
 
-int gateway_start(gateway_t *gateway)
+int gateway_set_integrity(gateway_t *gateway, char integrity)
 {
 	if(!gateway)
 		return -1;
 
-	set_root_caps();
+	return port_set_integrity(gateway->port, integrity);
+}
+
+int gateway_set_attr(gateway_t *gateway, thread2_attr_t *attr)
+{
+	if(!gateway || !attr)
+		return -1;
+
+	gateway->attr = *attr;
+
+	return 1;
+}
+
+int gateway_set_backend_attr(gateway_t *gateway, thread2_attr_t *attr)
+{
+	if(!gateway || !attr || !gateway->middleware_ops)
+		return -1;
+
+	gateway->backend_attr = *attr;
+	middleware_ops_set_attr(gateway->middleware_ops, &gateway->backend_attr);
+
+	return 1;
+}
+
+int gateway_start(gateway_t *gateway)
+{
+	if(!gateway || gateway->is_start)
+		return -1;
 
-    pthread_attr_t attr;
-    struct sched_param param;
+	set_root_caps();
 
-	pthread_attr_init(&attr);
-	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
-	pthread_attr_setschedpolicy(&attr, SCHED_RR);
-	param.sched_priority = 80;
-	pthread_attr_setschedparam(&attr, &param);
+	port_open(gateway->port);
+	prio_queue_open(&gateway->queue);
 
-	int ret = pthread_create(&gateway->port_pthread, &attr, port_thread, gateway);
-	if(ret != 0)
-		printf("pthread_create failed: %s\n", strerror(ret));
-	pthread_detach(gateway->port_pthread);
+	int ret = thread2_create(&gateway->port_pthread, &gateway->attr, port_thread, gateway);
+	if(ret != 1)
+		return -1;
 	sem_wait(&gateway->port_sem);
 
-	ret = pthread_create(&gateway->middleware_ops_pthread, &attr, middleware_ops_thread, gateway);
-	if(ret != 0)
-		printf("pthread_create failed: %s\n", strerror(ret));
-	pthread_detach(gateway->middleware_ops_pthread);
+	ret = thread2_create(&gateway->middleware_ops_pthread, &gateway->attr, middleware_ops_thread, gateway);
+	if(ret != 1)
+	{
+		port_set_state(gateway->port, PORT_STATE_DISCONN);
+		port_close(gateway->port, 0);
+		pthread_join(gateway->port_pthread, NULL);
+		return -1;
+	}
 	sem_wait(&gateway->middleware_ops_sem);
-
-	pthread_attr_destroy(&attr);
+	gateway->is_start = 1;
 
 	if(gateway->middleware_ops->start)
 		gateway->middleware_ops->start(gateway->middleware_ops);
 
+	gateway_route_send(gateway, GATEWAY_ROUTE_ADVERT);
+	timer2_start(&gateway->route_timer, GATEWAY_ROUTE_INTERVAL, 0);
+
+	gateway->group_gen = port_get_group_gen();
+	gateway_group_send(gateway, 0);
+	timer2_start(&gateway->group_timer, GATEWAY_GROUP_INTERVAL, 0);
+
+	return 1;
+}
+
+int gateway_get_stat(gateway_t *gateway, gateway_stat_t *stat)
+{
+	if(!gateway || !stat)
+		return -1;
+
+	pthread_mutex_lock(&gateway->credit_mutex);
+	*stat = gateway->stat;
+	stat->recv_drop = __atomic_load_n(&gateway->stat.recv_drop, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&gateway->credit_mutex);
+
 	return 1;
 }
 
 int gateway_stop(gateway_t *gateway)
 {
-	if(!gateway)
+	if(!gateway || !gateway->is_start)
 		return -1;
 	
+	timer2_stop(&gateway->group_timer);
+	gateway_group_send(gateway, 1);
+	timer2_stop(&gateway->route_timer);
+	gateway_route_send(gateway, GATEWAY_ROUTE_WITHDRAW);
+
+	port_set_state(gateway->port, PORT_STATE_DISCONN);
+	port_close(gateway->port, GATEWAY_DRAIN_TIME);
+	pthread_join(gateway->port_pthread, NULL);
+	
 	if(gateway->middleware_ops->stop)
 		gateway->middleware_ops->stop(gateway->middleware_ops);
 
-	pthread_cancel(gateway->middleware_ops_pthread);
-	port_set_state(gateway->port, PORT_STATE_DISCONN);
-	pthread_cancel(gateway->port_pthread);
+	/* nothing is received anymore, deliver what is queued */
+	prio_queue_close(&gateway->queue, GATEWAY_DRAIN_TIME);
+	pthread_join(gateway->middleware_ops_pthread, NULL);
+
+	sk_buffer_t *sk_buffer = NULL;
+	while((sk_buffer = port_try_recv(gateway->port)))
+		sk_buffer_destroy(sk_buffer);
+
+	struct list_head *node = NULL;
+	while((node = prio_queue_try_pop(&gateway->queue)))
+		sk_buffer_destroy(container_of(node, sk_buffer_t, node));
+
+	/* messages still waiting for credit of a peer are dropped like the rest */
+	pthread_mutex_lock(&gateway->credit_mutex);
+	int bkt = 0;
+	gateway_credit_t *credit = NULL;
+	hash_for_each(gateway->credit, GATEWAY_CREDIT_LEN, bkt, credit, node)
+	{
+		sk_buffer_t *tmp = NULL;
+		list_for_each_entry_safe(sk_buffer, tmp, &credit->backlog, node)
+		{
+			list_del(&sk_buffer->node);
+			sk_buffer_destroy(sk_buffer);
+			gateway->stat.credit_drop++;
+		}
+		credit->backlog_len = 0;
+		credit->queue = 0;
+	}
+	pthread_mutex_unlock(&gateway->credit_mutex);
+
+	gateway->is_start = 0;
 	
 	return 1;
 }
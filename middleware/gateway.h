@@ -10,20 +10,109 @@ extern "C"
 
 #include <pthread.h>
 #include <semaphore.h>
+#include "hashtable.h"
+#include "timer2.h"
 #include "port.h"
 #include "middleware.h"
 
+#define GATEWAY_EVENT_ROUTE 0xFFFF0001
+#define GATEWAY_ROUTE_INTERVAL 1000
+#define GATEWAY_ROUTE_TIMEOUT 3
+#define GATEWAY_EVENT_CREDIT 0xFFFF0002
+#define GATEWAY_CREDIT_WINDOW 256
+/* ms a peer may leave messages parked without returning credit before it is probed */
+#define GATEWAY_CREDIT_TIMEOUT 1000
+/* messages parked per peer while it has no credit, more wait for room or are dropped once it stalled */
+#define GATEWAY_CREDIT_BACKLOG 1024
+#define GATEWAY_CREDIT_LEN 64
+#define GATEWAY_QUEUE_MAX 4096
+#define GATEWAY_PRIORITY 0xFF
+#define GATEWAY_EVENT_GROUP 0xFFFF0003
+#define GATEWAY_GROUP_INTERVAL 100
+#define GATEWAY_GROUP_LEN 64
+/* hash, source, dest, option, event and length, the smallest frame taken from a transport */
+#define GATEWAY_FRAME_MIN 20
+/* ms each gateway thread keeps forwarding queued messages on stop before the rest is dropped */
+#define GATEWAY_DRAIN_TIME 100
+
+enum
+{
+	GATEWAY_ROUTE_UNKOWN = 0,
+	GATEWAY_ROUTE_ADVERT,
+	GATEWAY_ROUTE_WITHDRAW,
+};
+
+/* route prefix learned from the advert of another gateway */
+typedef struct
+{
+	unsigned short next;
+	unsigned char age;
+} gateway_route_t;
+
+/*
+ * per peer gateway: credit left for sending to it with the messages parked until it returns some,
+ * the last probe, unanswered with is_stall, and what was sent since, and messages from it queued or not yet credited back
+ */
+typedef struct
+{
+	unsigned short id;
+	int credit;
+	struct list_head backlog;
+	int backlog_len;
+	char is_drain;
+	char is_stall;
+	unsigned char age;
+	unsigned int probe;
+	int probe_sent;
+	int queue;
+	int ack;
+	struct hlist_node node;
+} gateway_credit_t;
+
+/* a group with members behind peer, learned from the group advert of that gateway, last is group for a single id */
+typedef struct
+{
+	unsigned int group;
+	unsigned int last;
+	unsigned short peer;
+	unsigned char age;
+	struct hlist_node node;
+} gateway_group_t;
+
+typedef struct
+{
+	unsigned long long credit_wait;
+	unsigned long long credit_timeout;
+	unsigned long long credit_drop;
+	unsigned long long recv_drop;
+} gateway_stat_t;
+
 typedef struct
 {
 	unsigned short id;
 	char type;
-	queue_t queue;
+	prio_queue_t queue;
 	port_t *port;
 	pthread_t port_pthread;
 	sem_t port_sem;
 	middleware_ops_t *middleware_ops;
 	pthread_t middleware_ops_pthread;
 	sem_t middleware_ops_sem;
+	gateway_route_t route[PORT_FIB_LEN];
+	pthread_mutex_t route_mutex;
+	timer2_t route_timer;
+	struct hlist_head credit[GATEWAY_CREDIT_LEN];
+	pthread_mutex_t credit_mutex;
+	pthread_cond_t credit_cond;
+	gateway_stat_t stat;
+	struct hlist_head group[GATEWAY_GROUP_LEN];
+	struct hlist_head range;
+	pthread_mutex_t group_mutex;
+	timer2_t group_timer;
+	unsigned int group_gen;
+	thread2_attr_t attr;
+	thread2_attr_t backend_attr;
+	char is_start;
 } gateway_t;
 
 int gateway_init(gateway_t *gateway, unsigned short id, char type);
@@ -34,10 +123,29 @@ gateway_t *gateway_create(unsigned short id, char type);
 
 int gateway_destroy(gateway_t *gateway);
 
+/*
+ * called before start, PORT_INTEGRITY_EDGE hashes messages leaving through the transport and checks them
+ * when they come in, HOP checks on the way out as well. Every gateway of a system should use the same.
+ */
+int gateway_set_integrity(gateway_t *gateway, char integrity);
+
+/* called before start, sets the scheduling of the gateway threads */
+int gateway_set_attr(gateway_t *gateway, thread2_attr_t *attr);
+
+/* called before start, sets the scheduling of the receive threads of the transport, which keep the pthread defaults otherwise */
+int gateway_set_backend_attr(gateway_t *gateway, thread2_attr_t *attr);
+
+/* may be called again after gateway_stop */
 int gateway_start(gateway_t *gateway);
 
+/*
+ * withdraws the routes, forwards the local messages still queued while the transport is up,
+ * stops the transport and delivers what it received, each for up to GATEWAY_DRAIN_TIME ms.
+ */
 int gateway_stop(gateway_t *gateway);
 
+int gateway_get_stat(gateway_t *gateway, gateway_stat_t *stat);
+
 #ifdef __cplusplus
 }
 #endif
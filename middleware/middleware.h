@@ -9,6 +9,7 @@ extern "C"
 #endif
 
 #include "sk_buffer.h"
+#include "thread2.h"
 
 enum
 {
@@ -32,6 +33,7 @@ typedef int (*recv_callback_t) (middleware_ops_t *middleware_ops, char *buffer,
 struct middleware_ops
 {
 	void *p;
+	thread2_attr_t *attr;
 	int (*init) (middleware_ops_t *middleware_ops, unsigned short id);
 	int (*exit) (middleware_ops_t *middleware_ops);
 	int (*send) (middleware_ops_t *middleware_ops, unsigned short id, sk_buffer_t *sk_buffer);
@@ -54,6 +56,12 @@ static inline void *middleware_ops_get_p(middleware_ops_t *middleware_ops)
     return middleware_ops->p;
 }
 
+/* scheduling of the receive threads created by start, NULL keeps the pthread defaults */
+static inline void middleware_ops_set_attr(middleware_ops_t *middleware_ops, thread2_attr_t *attr)
+{
+    middleware_ops->attr = attr;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -9,6 +9,8 @@
 #include "middleware_iox2.h"
 
 #define FRAME_LEN 307200
+/* ms a receive thread may take to notice middleware_iox2_stop */
+#define IOX2_STOP_INTERVAL 100
 
 typedef struct
 {
@@ -191,9 +193,14 @@ name_exit:
 	return -1;
 }
 
-static int iox2_send(iox2_pub_t *iox2_pub, char *buffer, int buffer_len)
+/* gathers the fragments of sk_buffer straight into the loaned frames */
+static int iox2_send(iox2_pub_t *iox2_pub, sk_buffer_t *sk_buffer)
 {
-	if(!iox2_pub || !buffer || buffer_len == 0)
+	if(!iox2_pub || !sk_buffer)
+		return -1;
+
+	int buffer_len = sk_buffer_len(sk_buffer);
+	if(buffer_len == 0)
 		return -1;
 
     if(buffer_len <= FRAME_LEN)
@@ -211,7 +218,7 @@ static int iox2_send(iox2_pub_t *iox2_pub, char *buffer, int buffer_len)
 
         packet->type = 0;
         packet->len = buffer_len;
-        memcpy(packet->frame, buffer, buffer_len);
+        sk_buffer_read(sk_buffer, 0, packet->frame, buffer_len);
 
 		ret = iox2_sample_mut_send(sample, NULL);
         if(ret != IOX2_OK)
@@ -254,7 +261,7 @@ static int iox2_send(iox2_pub_t *iox2_pub, char *buffer, int buffer_len)
                 packet->len = FRAME_LEN;
                 *((unsigned int *)(packet->frame + 1)) = buffer_len;
                 packet->frame[5] = package_num;
-                memcpy(packet->frame + 6, buffer, FRAME_LEN - 6);
+                sk_buffer_read(sk_buffer, 0, packet->frame + 6, FRAME_LEN - 6);
                 index += FRAME_LEN - 6;
             }
             else
@@ -262,13 +269,13 @@ static int iox2_send(iox2_pub_t *iox2_pub, char *buffer, int buffer_len)
                 if(remainder != 0 && i == (package_num - 1))
                 {
                     packet->len = buffer_len - index + 1;
-                    memcpy(packet->frame + 1, buffer + index, buffer_len - index);
+                    sk_buffer_read(sk_buffer, index, packet->frame + 1, buffer_len - index);
                     index = buffer_len;
                 }
                 else
                 {
                     packet->len = FRAME_LEN;
-                    memcpy(packet->frame + 1, buffer + index, FRAME_LEN - 1);
+                    sk_buffer_read(sk_buffer, index, packet->frame + 1, FRAME_LEN - 1);
                     index += FRAME_LEN - 1;
                 }
             }
@@ -332,7 +339,7 @@ int middleware_iox2_send(middleware_ops_t *middleware_ops, unsigned short id, sk
 		list_add_tail(&iox2_pub->node, &middleware_iox2->node);
 	}
 
-	iox2_send(iox2_pub, sk_buffer->data, sk_buffer->tail - sk_buffer->data);
+	iox2_send(iox2_pub, sk_buffer);
 
 exit:
 	pthread_mutex_unlock(&middleware_iox2->node_mutex);
@@ -444,18 +451,16 @@ static void *iox2_thread(void *para)
 	if(!para)
 		return NULL;
 
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
 	iox2_sub_t *iox2_sub = (iox2_sub_t *)para;
 
 	sem_post(&iox2_sub->sem);
 
-	while(1)
+	/* the wait times out now and then so a stop is noticed */
+	while(__atomic_load_n(&iox2_sub->is_run, __ATOMIC_ACQUIRE))
 	{
 		iox2_event_id_t iox2_event_id;
         bool is_wait_one = false;
-        iox2_listener_blocking_wait_one(&iox2_sub->listener, &iox2_event_id, &is_wait_one);
+        iox2_listener_timed_wait_one(&iox2_sub->listener, &iox2_event_id, &is_wait_one, 0, IOX2_STOP_INTERVAL * 1000000);
         if(is_wait_one)
         {
             iox2_sample_h sample = NULL;
@@ -499,8 +504,12 @@ int middleware_iox2_start(middleware_ops_t *middleware_ops)
 
 	for(int i = 0; i < 2; i++)
 	{
-		pthread_create(&middleware_iox2->iox2_sub[i].pthread, NULL, iox2_thread, &middleware_iox2->iox2_sub[i]);
-		pthread_detach(middleware_iox2->iox2_sub[i].pthread);
+		middleware_iox2->iox2_sub[i].is_run = 1;
+		if(thread2_create(&middleware_iox2->iox2_sub[i].pthread, middleware_ops->attr, iox2_thread, &middleware_iox2->iox2_sub[i]) != 1)
+		{
+			middleware_iox2->iox2_sub[i].is_run = 0;
+			return -1;
+		}
 		sem_wait(&middleware_iox2->iox2_sub[i].sem);
 	}
 
@@ -517,7 +526,13 @@ int middleware_iox2_stop(middleware_ops_t *middleware_ops)
 		return -1;
 
 	for(int i = 0; i < 2; i++)
-		pthread_cancel(middleware_iox2->iox2_sub[i].pthread);
+	{
+		if(!middleware_iox2->iox2_sub[i].is_run)
+			continue;
+
+		__atomic_store_n(&middleware_iox2->iox2_sub[i].is_run, 0, __ATOMIC_RELEASE);
+		pthread_join(middleware_iox2->iox2_sub[i].pthread, NULL);
+	}
 
 	return 1;
 }
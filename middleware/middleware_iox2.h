@@ -24,6 +24,7 @@ typedef struct
 	iox2_port_factory_event_h event_service;
 	iox2_listener_h listener;
 	pthread_t pthread;
+	char is_run;
 	sem_t sem;
 	middleware_iox2_t *middleware_iox2;
 } iox2_sub_t;
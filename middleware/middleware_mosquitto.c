@@ -64,7 +64,12 @@ int middleware_mosquitto_send(middleware_ops_t *middleware_ops, unsigned short i
 	memset(topic, 0x00, sizeof(topic));
 	snprintf(topic, sizeof(topic), "process%05d", id);
 
-	mosquitto_publish(middleware_mosquitto->mosquitto.mosquitto, NULL, topic, sk_buffer->tail - sk_buffer->data, sk_buffer->data, 0, false);
+	sk_buffer_t *sk_buffer2 = sk_buffer_linearize(sk_buffer);
+	if(!sk_buffer2)
+		return -1;
+
+	mosquitto_publish(middleware_mosquitto->mosquitto.mosquitto, NULL, topic, sk_buffer2->tail - sk_buffer2->data, sk_buffer2->data, 0, false);
+	sk_buffer_destroy(sk_buffer2);
 	
 	return 1;
 }
@@ -12,6 +12,8 @@
 #include "middleware_nng.h"
 
 #define PORT_ID_LEN 5
+/* ms a receive thread may take to notice middleware_nng_stop */
+#define NNG_STOP_INTERVAL 100
 
 typedef struct
 {
@@ -19,10 +21,12 @@ typedef struct
 	nng_socket sock;
 	recv_callback_t cb;
 	pthread_t pthread;
+	char is_run;
 	middleware_nng_t *middleware_nng;
 	struct list_head node;
 } nng_node_t;
 
+/* gateways to dial, routes behind them are learned from their adverts */
 static unsigned short port_id[PORT_ID_LEN] = {PORT_MCU_ROUTE, PORT_MPU_ROUTE, PORT_MPU_TEST_ROUTE, PORT_MPU_TEST2_ROUTE, PORT_MPU_TEST3_ROUTE};
 
 int middleware_nng_init(middleware_ops_t *middleware_ops, unsigned short id)
@@ -83,6 +87,26 @@ int middleware_nng_exit(middleware_ops_t *middleware_ops)
 	return 1;
 }
 
+/* sends topic followed by the fragments of sk_buffer as one message, the headroom is left alone */
+static int nng_send2(nng_socket sock, const char *topic, sk_buffer_t *sk_buffer)
+{
+	nng_msg *msg = NULL;
+	int ret = nng_msg_alloc(&msg, 0);
+	if(ret != 0)
+		return ret;
+
+	ret = nng_msg_append(msg, topic, strlen(topic));
+	for(; sk_buffer && ret == 0; sk_buffer = sk_buffer->frag)
+		ret = nng_msg_append(msg, sk_buffer->data, sk_buffer->tail - sk_buffer->data);
+
+	if(ret == 0)
+		ret = nng_sendmsg(sock, msg, 0);
+	if(ret != 0)
+		nng_msg_free(msg);
+
+	return ret;
+}
+
 int middleware_nng_send(middleware_ops_t *middleware_ops, unsigned short id, sk_buffer_t *sk_buffer)
 {
 	if(!middleware_ops || id == PORT_UNKOWN || !sk_buffer)
@@ -92,30 +116,15 @@ int middleware_nng_send(middleware_ops_t *middleware_ops, unsigned short id, sk_
 	if(!middleware_nng)
 		return -1;
 
-	if(id != PORT_BROADCAST)
-	{
-		char topic[16] = "";
-		memset(topic, 0x00, sizeof(topic));
-		snprintf(topic, sizeof(topic), "process%05d", id);
+	char topic[16] = "";
+	memset(topic, 0x00, sizeof(topic));
+	snprintf(topic, sizeof(topic), "process%05d", id);
 
-		sk_buffer_push_copy(sk_buffer, topic, strlen(topic));
-		nng_send(middleware_nng->nng.sock, sk_buffer->data, sk_buffer->tail - sk_buffer->data, 0);
-	}
-	else if(id == PORT_BROADCAST)
+	int ret = nng_send2(middleware_nng->nng.sock, topic, sk_buffer);
+	if(ret != 0)
 	{
-		for(int i = 0; i < PORT_ID_LEN; i++)
-		{
-			if(middleware_nng->nng.id != port_id[i])
-			{
-				char topic[16] = "";
-				memset(topic, 0x00, sizeof(topic));
-				snprintf(topic, sizeof(topic), "process%05d", id);
-
-				sk_buffer_push_copy(sk_buffer, topic, strlen(topic));
-				nng_send(middleware_nng->nng.sock, sk_buffer->data, sk_buffer->tail - sk_buffer->data, 0);
-				sk_buffer_pull(sk_buffer, strlen(topic));
-			}
-		}
+		printf("%s-%d: %s\n", __func__, __LINE__, nng_strerror(ret));
+		return -1;
 	}
 
 	return 1;
@@ -166,9 +175,6 @@ static void *nng_thread(void *para)
 	if(!para)
 		return NULL;
 
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
 	nng_node_t *nng_node = (nng_node_t *)para;
 
 	int ret = nng_sub0_open(&nng_node->sock);
@@ -178,6 +184,9 @@ static void *nng_thread(void *para)
 		return NULL;
 	}
 
+	/* receiving times out now and then so a stop is noticed, the socket is only used by this thread */
+	nng_setopt_ms(nng_node->sock, NNG_OPT_RECVTIMEO, NNG_STOP_INTERVAL);
+
 	char topic[16] = "";
 	memset(topic, 0x00, sizeof(topic));
 	snprintf(topic, sizeof(topic), "process%05d", nng_node->middleware_nng->nng.id);
@@ -186,48 +195,55 @@ static void *nng_thread(void *para)
 	if(ret != 0)
 	{
 		printf("%s-%d: %s\n", __func__, __LINE__, nng_strerror(ret));
-		return NULL;
+		goto exit;
+	}
+
+	char topic2[16] = "process65535";
+	ret = nng_setopt(nng_node->sock, NNG_OPT_SUB_SUBSCRIBE, topic2, len);
+	if(ret != 0)
+	{
+		printf("%s-%d: %s\n", __func__, __LINE__, nng_strerror(ret));
+		goto exit;
 	}
 
 	char url[32] = "";
 	memset(url, 0x00, sizeof(url));
 	snprintf(url, sizeof(url), "ipc:///tmp/%05d", nng_node->id);
 	
-	while(1)
+	ret = -1;
+	while(ret != 0 && __atomic_load_n(&nng_node->is_run, __ATOMIC_ACQUIRE))
 	{
-		ret = -1;
-
-		while(ret != 0)
+		ret = nng_dial(nng_node->sock, url, NULL, 0);
+		if(ret != 0)
 		{
-			ret = nng_dial(nng_node->sock, url, NULL, 0);
-			if(ret != 0)
-			{
-				// printf("%s-%d: %s\n", __func__, __LINE__, nng_strerror(ret));
-				usleep(500 * 1000);
-			}
+			// printf("%s-%d: %s\n", __func__, __LINE__, nng_strerror(ret));
+			usleep(500 * 1000);
 		}
+	}
+
+	while(__atomic_load_n(&nng_node->is_run, __ATOMIC_ACQUIRE))
+	{
+		char *buffer = NULL;
+		size_t buffer_len = 0;
+		if(nng_recv(nng_node->sock, &buffer, &buffer_len, NNG_FLAG_ALLOC) != 0)
+			continue;
 		
-		while(1)
+		if(buffer_len >= len && (memcmp(buffer, topic, len) == 0 || memcmp(buffer, topic2, len) == 0))
 		{
-			char *buffer = NULL;
-			size_t buffer_len = 0;
-			nng_recv(nng_node->sock, &buffer, &buffer_len, NNG_FLAG_ALLOC);
-			
-			ret = memcmp(buffer, topic, len);
-			if(ret == 0)
-			{
-				pthread_mutex_lock(&nng_node->middleware_nng->node_mutex);
-
-				if(nng_node->cb)
-					nng_node->cb(&nng_node->middleware_nng->middleware_ops, buffer + len, buffer_len - len);
-
-				pthread_mutex_unlock(&nng_node->middleware_nng->node_mutex);
-			}
-
-			nng_free(buffer, buffer_len);
+			pthread_mutex_lock(&nng_node->middleware_nng->node_mutex);
+
+			if(nng_node->cb)
+				nng_node->cb(&nng_node->middleware_nng->middleware_ops, buffer + len, buffer_len - len);
+
+			pthread_mutex_unlock(&nng_node->middleware_nng->node_mutex);
 		}
+
+		nng_free(buffer, buffer_len);
 	}
 
+exit:
+	nng_close(nng_node->sock);
+
 	return NULL;
 }
 
@@ -243,8 +259,9 @@ int middleware_nng_start(middleware_ops_t *middleware_ops)
 	nng_node_t *link = NULL;
 	list_for_each_entry(link, &middleware_nng->node, node)
 	{
-		pthread_create(&link->pthread, NULL, nng_thread, link);
-		pthread_detach(link->pthread);
+		link->is_run = 1;
+		if(thread2_create(&link->pthread, middleware_ops->attr, nng_thread, link) != 1)
+			link->is_run = 0;
 	}
 
 	return 1;
@@ -262,8 +279,11 @@ int middleware_nng_stop(middleware_ops_t *middleware_ops)
 	nng_node_t *link = NULL;
 	list_for_each_entry(link, &middleware_nng->node, node)
 	{
-		nng_close(link->sock);
-		pthread_cancel(link->pthread);
+		if(!link->is_run)
+			continue;
+
+		__atomic_store_n(&link->is_run, 0, __ATOMIC_RELEASE);
+		pthread_join(link->pthread, NULL);
 	}
 
 	return 1;
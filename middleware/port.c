@@ -4,19 +4,386 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "rcu.h"
 #include "util.h"
+#include "trace.h"
 #include "port.h"
 
+typedef struct
+{
+	struct rcu_head rcu;
+	int len;
+	port_t *port[0];
+} port_set_t;
+
+typedef struct
+{
+	unsigned int group;
+	unsigned int count;
+	port_t *port;
+} port_member_t;
+
+/* immutable member list of one group bucket, replaced as a whole on join and leave */
+typedef struct
+{
+	struct rcu_head rcu;
+	int len;
+	port_member_t member[0];
+} port_group_t;
+
+typedef struct
+{
+	unsigned int first;
+	unsigned int last;
+	unsigned int count;
+	port_t *port;
+} port_span_t;
+
+/* the group ranges joined by ports, only used with port_list_mutex held */
+typedef struct
+{
+	int len;
+	port_span_t span[0];
+} port_range_t;
+
+/* the distinct ports that joined every group of first to last through a range */
+typedef struct
+{
+	unsigned int first;
+	unsigned int last;
+	int len;
+	port_t *port[0];
+} port_slice_t;
+
+/* disjoint slices of the joined ranges sorted by group, rebuilt as a whole on join and leave */
+typedef struct
+{
+	struct rcu_head rcu;
+	int len;
+	port_slice_t *slice[0];
+} port_slices_t;
+
 static char is_first = 0;
 static struct list_head port_list;
 static pthread_mutex_t port_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static port_t *port_table[PORT_TABLE_LEN];
+static port_set_t *port_set;
+static port_group_t *port_group[PORT_GROUP_LEN];
+static unsigned int port_group_gen;
+static port_range_t *port_range;
+static port_slices_t *port_slices;
+
+/* keeps port from being freed once the caller leaves rcu_read_lock, called under it */
+static void port_get2(port_t *port)
+{
+	__atomic_add_fetch(&port->ref, 1, __ATOMIC_RELAXED);
+}
+
+static void port_put2(port_t *port)
+{
+	__atomic_sub_fetch(&port->ref, 1, __ATOMIC_RELEASE);
+}
+
+static void port_set_free(struct rcu_head *rcu)
+{
+	port_set_t *set = container_of(rcu, port_set_t, rcu);
+
+	free(set);
+}
+
+static int port_set_update(void)
+{
+	int len = 0;
+
+	port_t *link = NULL;
+	list_for_each_entry(link, &port_list, node)
+		len++;
+
+	port_set_t *set = (port_set_t *)calloc(1, sizeof(port_set_t) + len * sizeof(port_t *));
+	if(!set)
+		return -1;
+
+	list_for_each_entry(link, &port_list, node)
+		set->port[set->len++] = link;
+
+	port_set_t *old = port_set;
+	rcu_assign_pointer(port_set, set);
+	if(old)
+		call_rcu(&old->rcu, port_set_free);
+
+	return 1;
+}
+
+static void port_group_free(struct rcu_head *rcu)
+{
+	port_group_t *group = container_of(rcu, port_group_t, rcu);
+
+	free(group);
+}
+
+/* copies bucket index with count added to the membership of port in group, dropping members whose count reaches 0 */
+static int port_group_update(int index, port_t *port, unsigned int group, int count)
+{
+	port_group_t *old = port_group[index];
+	int len = old ? old->len : 0;
+
+	port_group_t *new = (port_group_t *)calloc(1, sizeof(port_group_t) + (len + 1) * sizeof(port_member_t));
+	if(!new)
+		return -1;
+
+	char is_found = 0;
+	for(int i = 0; i < len; i++)
+	{
+		port_member_t member = old->member[i];
+		if(member.port == port && (member.group == group || count == 0))
+		{
+			is_found = 1;
+			if(count == 0 || (int)member.count + count <= 0)
+				continue;
+
+			member.count += count;
+		}
+
+		new->member[new->len++] = member;
+	}
+
+	if(!is_found)
+	{
+		if(count <= 0)
+		{
+			free(new);
+			return count == 0 ? 1 : -1;
+		}
+
+		new->member[new->len].group = group;
+		new->member[new->len].count = count;
+		new->member[new->len].port = port;
+		new->len++;
+	}
+
+	if(new->len == 0)
+	{
+		free(new);
+		new = NULL;
+	}
+
+	rcu_assign_pointer(port_group[index], new);
+	if(old)
+		call_rcu(&old->rcu, port_group_free);
+
+	__atomic_add_fetch(&port_group_gen, 1, __ATOMIC_RELAXED);
+
+	return 1;
+}
+
+static void port_slices_free(struct rcu_head *rcu)
+{
+	port_slices_t *slices = container_of(rcu, port_slices_t, rcu);
+
+	for(int i = 0; i < slices->len; i++)
+		free(slices->slice[i]);
+	free(slices);
+}
+
+static int port_bound_cmp(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* rebuilds the disjoint slices from port_range, called with port_list_mutex held */
+static int port_slices_update(void)
+{
+	port_range_t *range = port_range;
+	port_slices_t *old = port_slices;
+	int num = range ? range->len : 0;
+
+	port_slices_t *new = NULL;
+	unsigned long long *bound = NULL;
+	if(num == 0)
+		goto publish;
+
+	bound = (unsigned long long *)calloc(num * 2, sizeof(unsigned long long));
+	new = (port_slices_t *)calloc(1, sizeof(port_slices_t) + num * 2 * sizeof(port_slice_t *));
+	if(!bound || !new)
+		goto error;
+
+	int len = 0;
+	for(int i = 0; i < num; i++)
+	{
+		bound[len++] = range->span[i].first;
+		bound[len++] = (unsigned long long)range->span[i].last + 1;
+	}
+	qsort(bound, len, sizeof(unsigned long long), port_bound_cmp);
+
+	for(int i = 0; i + 1 < len; i++)
+	{
+		if(bound[i] == bound[i + 1])
+			continue;
+
+		port_slice_t *slice = (port_slice_t *)calloc(1, sizeof(port_slice_t) + num * sizeof(port_t *));
+		if(!slice)
+			goto error;
+
+		slice->first = bound[i];
+		slice->last = bound[i + 1] - 1;
+		for(int j = 0; j < num; j++)
+		{
+			port_span_t *span = &range->span[j];
+			if(span->first > slice->first || span->last < slice->last)
+				continue;
+
+			int k = 0;
+			while(k < slice->len && slice->port[k] != span->port)
+				k++;
+			if(k == slice->len)
+				slice->port[slice->len++] = span->port;
+		}
+
+		if(slice->len == 0)
+		{
+			free(slice);
+			continue;
+		}
+
+		new->slice[new->len++] = slice;
+	}
+
+	free(bound);
+
+publish:
+	rcu_assign_pointer(port_slices, new);
+	if(old)
+		call_rcu(&old->rcu, port_slices_free);
+
+	return 1;
+
+error:
+	free(bound);
+	if(new)
+		port_slices_free(&new->rcu);
+
+	return -1;
+}
+
+/* same as port_group_update for the range first to last, then rebuilds the slices */
+static int port_range_update(port_t *port, unsigned int first, unsigned int last, int count)
+{
+	port_range_t *old = port_range;
+	int len = old ? old->len : 0;
+
+	port_range_t *new = (port_range_t *)calloc(1, sizeof(port_range_t) + (len + 1) * sizeof(port_span_t));
+	if(!new)
+		return -1;
+
+	char is_found = 0;
+	for(int i = 0; i < len; i++)
+	{
+		port_span_t span = old->span[i];
+		if(span.port == port && ((span.first == first && span.last == last) || count == 0))
+		{
+			is_found = 1;
+			if(count == 0 || (int)span.count + count <= 0)
+				continue;
+
+			span.count += count;
+		}
+
+		new->span[new->len++] = span;
+	}
+
+	if(!is_found)
+	{
+		if(count <= 0)
+		{
+			free(new);
+			return count == 0 ? 1 : -1;
+		}
+
+		new->span[new->len].first = first;
+		new->span[new->len].last = last;
+		new->span[new->len].count = count;
+		new->span[new->len].port = port;
+		new->len++;
+	}
+
+	if(new->len == 0)
+	{
+		free(new);
+		new = NULL;
+	}
+
+	port_range = new;
+	free(old);
+
+	__atomic_add_fetch(&port_group_gen, 1, __ATOMIC_RELAXED);
+
+	return port_slices_update();
+}
+
+static void port_fib_build(port_t *port, const char *is_local)
+{
+	for(int i = 0; i < PORT_FIB_LEN; i++)
+	{
+		unsigned short dest = (i << 7) | 0x7E;
+		unsigned short dest2 = (i << 7) | 0x7D;
+		unsigned short next = port->route[i];
+		unsigned short next2 = next;
+		if(next == PORT_UNKOWN)
+		{
+			next = port_get_next_jump(port->id, dest);
+			next2 = port_get_next_jump(port->id, dest2);
+		}
+
+		unsigned int route = next;
+		port_t *next_port = NULL;
+		if(next == dest && next2 == dest2)
+			route = PORT_FIB_DIRECT;
+		else if(next != PORT_UNKOWN)
+		{
+			next_port = port_table[next];
+			if(port_get_state(next_port) != PORT_STATE_CONN)
+				next_port = NULL;
+		}
+
+		if(is_local[i])
+			route |= PORT_FIB_LOCAL;
+
+		__atomic_store_n(&port->fib[i].route, route, __ATOMIC_RELAXED);
+		rcu_assign_pointer(port->fib[i].port, next_port);
+	}
+}
+
+static void port_fib_local(char *is_local)
+{
+	memset(is_local, 0x00, PORT_FIB_LEN);
+
+	port_t *link = NULL;
+	list_for_each_entry(link, &port_list, node)
+		is_local[PORT_FIB_INDEX(link->id)] = 1;
+}
 
-port_t *port_get_by_id(unsigned short id);
+static void port_fib_update(void)
+{
+	char is_local[PORT_FIB_LEN];
+	port_fib_local(is_local);
+
+	port_t *link = NULL;
+	list_for_each_entry(link, &port_list, node)
+		port_fib_build(link, is_local);
+}
 
 int port_init(port_t *port, unsigned short id)
 {
+	int ret = -1;
+
 	if(!port || id == PORT_UNKOWN || id == PORT_BROADCAST)
-		return -1;
+		return ret;
 	
 	pthread_mutex_lock(&port_list_mutex);
 	
@@ -26,49 +393,100 @@ int port_init(port_t *port, unsigned short id)
 		INIT_LIST_HEAD(&port_list);
 	}
 	
-	pthread_mutex_unlock(&port_list_mutex);
+	if(port_table[id])
+		goto exit;
 	
-	port_t *port2 = port_get_by_id(id);
-	if(port2)
-		return -1;
+	port->fib = (port_fib_t *)calloc(PORT_FIB_LEN, sizeof(port_fib_t));
+	if(!port->fib)
+		goto exit;
+	
+	port->route = (unsigned short *)calloc(PORT_FIB_LEN, sizeof(unsigned short));
+	if(!port->route)
+	{
+		free(port->fib);
+		port->fib = NULL;
+		goto exit;
+	}
 	
 	port->id = id;
 	port->state = PORT_STATE_INIT;
-	queue_init(&port->queue, -1);
+	memset(&port->stat, 0x00, sizeof(port->stat));
+	prio_queue_init(&port->queue, PORT_QUEUE_MAX, PORT_QUEUE_GUARD);
+	pthread_mutex_init(&port->conflate_mutex, NULL);
+	hash_init(port->conflate, PORT_CONFLATE_LEN);
+	port->fd = -1;
+	port->spin_max = 0;
+	port->spin = 0;
+	port->integrity = PORT_INTEGRITY_EDGE;
+	port->ref = 0;
 	
-	pthread_mutex_lock(&port_list_mutex);
 	list_add_tail(&port->node, &port_list);
+	port_set_update();
+	rcu_assign_pointer(port_table[id], port);
+	port_fib_update();
+	ret = 1;
+	
+exit:
 	pthread_mutex_unlock(&port_list_mutex);
 	
-	return 1;
+	return ret;
 }
 
 int port_exit(port_t *port)
 {
-	int ret = -1;
-	
 	if(!port)
-		return ret;
+		return -1;
 	
 	pthread_mutex_lock(&port_list_mutex);
 	
-	port_t *link = NULL, *next = NULL;
-	list_for_each_entry_safe(link, next, &port_list, node)
+	if(port_table[port->id] != port)
 	{
-		if(link == port)
-		{
-			list_del(&link->node);
-			queue_exit(&link->queue);
-			link->state = PORT_STATE_EXIT;
-			ret = 1;
-			goto exit;
-		}
-    }
+		pthread_mutex_unlock(&port_list_mutex);
+		return -1;
+	}
+	
+	rcu_assign_pointer(port_table[port->id], NULL);
+	for(int i = 0; i < PORT_GROUP_LEN; i++)
+		port_group_update(i, port, 0, 0);
+	port_range_update(port, 0, 0, 0);
+	list_del(&port->node);
+	port_set_update();
+	port->state = PORT_STATE_EXIT;
+	port_fib_update();
 	
-exit:
 	pthread_mutex_unlock(&port_list_mutex);
 	
-	return ret;
+	synchronize_rcu();
+
+	/* nobody can pin the port anymore, wake the senders waiting on it and let them go */
+	prio_queue_close(&port->queue, 0);
+	while(__atomic_load_n(&port->ref, __ATOMIC_ACQUIRE) > 0)
+		sched_yield();
+
+	struct list_head *node = NULL;
+	while((node = prio_queue_try_pop(&port->queue)))
+		sk_buffer_destroy(container_of(node, sk_buffer_t, node));
+
+	int bkt = 0;
+	port_conflate_t *conflate = NULL;
+	struct hlist_node *next = NULL;
+	hash_for_each_safe(port->conflate, PORT_CONFLATE_LEN, bkt, next, conflate, node)
+	{
+		hash_del(&conflate->node);
+		sk_buffer_put(conflate->sk_buffer);
+		free(conflate);
+	}
+	pthread_mutex_destroy(&port->conflate_mutex);
+	if(port->fd >= 0)
+		close(port->fd);
+	port->fd = -1;
+	prio_queue_exit(&port->queue);
+	free(port->route);
+	port->route = NULL;
+	free(port->fib);
+	port->fib = NULL;
+	
+	return 1;
 }
 
 port_t *port_create(unsigned short id)
@@ -101,31 +519,84 @@ int port_destroy(port_t *port)
 	return 1;
 }
 
-port_t *port_get_by_id(unsigned short id)
+int port_set_state(port_t *port, char state)
 {
-	port_t *ret = NULL;
-	
-	if(id == PORT_UNKOWN || id == PORT_BROADCAST)
-		return NULL;
+	if(!port)
+		return -1;
 	
 	pthread_mutex_lock(&port_list_mutex);
 	
-	port_t *link = NULL;
-	list_for_each_entry(link, &port_list, node)
-	{
-		if(link->id == id)
-		{
-			ret = link;
-			goto exit;
-		}
-	}
+	port->state = state;
+	if(port_table[port->id] == port)
+		port_fib_update();
 	
-exit:
 	pthread_mutex_unlock(&port_list_mutex);
 	
+	return 1;
+}
+
+static int port_set_route(port_t *port, unsigned short dest, unsigned short next)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&port_list_mutex);
+
+	if(port_table[port->id] == port)
+	{
+		char is_local[PORT_FIB_LEN];
+		port_fib_local(is_local);
+
+		port->route[PORT_FIB_INDEX(dest)] = next;
+		port_fib_build(port, is_local);
+		ret = 1;
+	}
+
+	pthread_mutex_unlock(&port_list_mutex);
+
 	return ret;
 }
 
+int port_add_route(port_t *port, unsigned short dest, unsigned short next)
+{
+	if(!port || dest == PORT_UNKOWN || dest == PORT_BROADCAST || next == PORT_UNKOWN || next == PORT_BROADCAST)
+		return -1;
+
+	return port_set_route(port, dest, next);
+}
+
+int port_del_route(port_t *port, unsigned short dest)
+{
+	if(!port || dest == PORT_UNKOWN || dest == PORT_BROADCAST)
+		return -1;
+
+	return port_set_route(port, dest, PORT_UNKOWN);
+}
+
+int port_get_local(char *is_local)
+{
+	if(!is_local)
+		return -1;
+
+	pthread_mutex_lock(&port_list_mutex);
+
+	if(is_first == 0)
+		memset(is_local, 0x00, PORT_FIB_LEN);
+	else
+		port_fib_local(is_local);
+
+	pthread_mutex_unlock(&port_list_mutex);
+
+	return 1;
+}
+
+port_t *port_get_by_id(unsigned short id)
+{
+	if(id == PORT_UNKOWN || id == PORT_BROADCAST)
+		return NULL;
+	
+	return rcu_dereference(port_table[id]);
+}
+
 unsigned short port_get_next_jump(unsigned short current, unsigned short dest)
 {
     unsigned short next = PORT_UNKOWN;
@@ -183,71 +654,720 @@ unsigned short port_get_next_jump(unsigned short current, unsigned short dest)
     return PORT_UNKOWN;
 }
 
-int port_send(port_t *port, unsigned short dest, sk_buffer_t *sk_buffer)
+int port_get_stat(port_t *port, port_stat_t *stat)
 {
-	if(!port || dest == PORT_UNKOWN || !sk_buffer)
-		return -1;
-
-	char state = port_get_state(port);
-	if(state != PORT_STATE_CONN)
+	if(!port || !stat)
 		return -1;
 
-	port_t *dest_port = port_get_by_id(dest);
-	if(!dest_port)
-	{
-		unsigned short next = port_get_next_jump(port->id, dest);
-		if(next != PORT_UNKOWN)
-			dest_port = port_get_by_id(next);
-	}
-	
-	state = port_get_state(dest_port);
-	if(state != PORT_STATE_CONN)
-		return -1;
+	stat->push = __atomic_load_n(&port->stat.push, __ATOMIC_RELAXED);
+	stat->block = __atomic_load_n(&port->stat.block, __ATOMIC_RELAXED);
+	stat->would_block = __atomic_load_n(&port->stat.would_block, __ATOMIC_RELAXED);
+	stat->conflate = __atomic_load_n(&port->stat.conflate, __ATOMIC_RELAXED);
 
-	queue_push(&dest_port->queue, &sk_buffer->node);
-	
 	return 1;
 }
 
-int port_broadcast(port_t *port, sk_buffer_t *sk_buffer)
+/* called with conflate_mutex held */
+static port_conflate_t *port_conflate_get(port_t *port, unsigned long long key)
 {
-	if(!port || !sk_buffer)
-		return -1;
-	
-	char state = port_get_state(port);
+	port_conflate_t *link = NULL;
+	hash_for_each_possible(port->conflate, PORT_CONFLATE_LEN, link, node, key)
+		if(link->key == key)
+			return link;
+
+	return NULL;
+}
+
+/* swaps sk_buffer in for the queued message of key, returns 0 when there is none and sk_buffer must be queued */
+static int port_conflate2(port_t *port, unsigned long long key, sk_buffer_t *sk_buffer)
+{
+	pthread_mutex_lock(&port->conflate_mutex);
+
+	port_conflate_t *conflate = port_conflate_get(port, key);
+	if(!conflate)
+	{
+		conflate = (port_conflate_t *)calloc(1, sizeof(port_conflate_t));
+		if(!conflate)
+		{
+			pthread_mutex_unlock(&port->conflate_mutex);
+			return -1;
+		}
+
+		conflate->key = key;
+		hash_add(port->conflate, PORT_CONFLATE_LEN, &conflate->node, key);
+	}
+
+	int ret = 0;
+	sk_buffer_t *old = conflate->sk_buffer;
+	if(old && prio_queue_replace(&port->queue, &old->node, &sk_buffer->node) == 1)
+	{
+		sk_buffer_put(old);
+		ret = 1;
+	}
+	else
+		INIT_LIST_HEAD(&sk_buffer->node);
+
+	conflate->sk_buffer = sk_buffer_get(sk_buffer);
+
+	pthread_mutex_unlock(&port->conflate_mutex);
+
+	if(old)
+		sk_buffer_put(old);
+
+	return ret;
+}
+
+/* wakes a reader polling the eventfd of port */
+static void port_notify(port_t *port)
+{
+	int fd = __atomic_load_n(&port->fd, __ATOMIC_ACQUIRE);
+	if(fd < 0)
+		return;
+
+	unsigned long long value = 1;
+	if(write(fd, &value, sizeof(value)) < 0)
+		return;
+}
+
+/* queues sk_buffer unless its lane is full, returns 0 then without counting it */
+static int port_try_push2(port_t *port, sk_buffer_t *sk_buffer)
+{
+	trace_stamp(sk_buffer, TRACE_ENQUEUE);
+
+	unsigned long long key = port->conflate_cb ? port->conflate_cb(port, sk_buffer) : 0;
+	if(key && port_conflate2(port, key, sk_buffer) == 1)
+	{
+		__atomic_fetch_add(&port->stat.conflate, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	int ret = prio_queue_try_push(&port->queue, &sk_buffer->node, PORT_PRIORITY_LANE(sk_buffer->priority));
+	if(ret == 1)
+	{
+		__atomic_fetch_add(&port->stat.push, 1, __ATOMIC_RELAXED);
+		port_notify(port);
+	}
+
+	return ret;
+}
+
+/* waits for room after port_try_push2 returned 0, never called under rcu_read_lock */
+static int port_wait_push2(port_t *port, sk_buffer_t *sk_buffer)
+{
+	__atomic_fetch_add(&port->stat.block, 1, __ATOMIC_RELAXED);
+
+	int ret = prio_queue_push(&port->queue, &sk_buffer->node, PORT_PRIORITY_LANE(sk_buffer->priority));
+	if(ret == 1)
+	{
+		__atomic_fetch_add(&port->stat.push, 1, __ATOMIC_RELAXED);
+		port_notify(port);
+	}
+
+	return ret;
+}
+
+int port_push(port_t *port, sk_buffer_t *sk_buffer, char is_block)
+{
+	if(!port || !sk_buffer)
+		return -1;
+
+	int ret = port_try_push2(port, sk_buffer);
+	if(ret != 0)
+		return ret;
+
+	if(!is_block)
+	{
+		__atomic_fetch_add(&port->stat.would_block, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	return port_wait_push2(port, sk_buffer);
+}
+
+/* the port that takes messages from port to dest, called under rcu_read_lock */
+static port_t *port_get_dest(port_t *port, unsigned short dest)
+{
+	port_fib_t *fib = &port->fib[PORT_FIB_INDEX(dest)];
+	unsigned int route = __atomic_load_n(&fib->route, __ATOMIC_RELAXED);
+
+	port_t *dest_port = NULL;
+	if(route & (PORT_FIB_DIRECT | PORT_FIB_LOCAL))
+		dest_port = port_get_by_id(dest);
+	if(!dest_port)
+		dest_port = rcu_dereference(fib->port);
+
+	return dest_port;
+}
+
+static int port_send2(port_t *port, unsigned short dest, sk_buffer_t *sk_buffer, char is_block)
+{
+	int ret = -1;
+
+	if(!port || dest == PORT_UNKOWN || dest == PORT_BROADCAST || !sk_buffer)
+		return ret;
+
+	char state = port_get_state(port);
+	if(state != PORT_STATE_CONN)
+		return ret;
+
+	rcu_read_lock();
+
+	port_t *dest_port = port_get_dest(port, dest);
+	
+	state = port_get_state(dest_port);
+	if(state != PORT_STATE_CONN)
+	{
+		rcu_read_unlock();
+		return ret;
+	}
+
+	ret = port_try_push2(dest_port, sk_buffer);
+	if(ret != 0)
+	{
+		rcu_read_unlock();
+		return ret;
+	}
+
+	if(!is_block)
+	{
+		__atomic_fetch_add(&dest_port->stat.would_block, 1, __ATOMIC_RELAXED);
+		rcu_read_unlock();
+		return ret;
+	}
+
+	/* the lane is full, wait with dest_port pinned instead of holding up grace periods */
+	port_get2(dest_port);
+	rcu_read_unlock();
+
+	ret = port_wait_push2(dest_port, sk_buffer);
+	port_put2(dest_port);
+	
+	return ret;
+}
+
+int port_send(port_t *port, unsigned short dest, sk_buffer_t *sk_buffer)
+{
+	return port_send2(port, dest, sk_buffer, 1);
+}
+
+int port_try_send(port_t *port, unsigned short dest, sk_buffer_t *sk_buffer)
+{
+	return port_send2(port, dest, sk_buffer, 0);
+}
+
+int port_send_list(port_t *port, unsigned short dest, struct list_head *list)
+{
+	int ret = -1;
+
+	if(!port || dest == PORT_UNKOWN || dest == PORT_BROADCAST || !list || list_empty(list))
+		return ret;
+
+	char state = port_get_state(port);
+	if(state != PORT_STATE_CONN)
+		return ret;
+
+	rcu_read_lock();
+
+	port_t *dest_port = port_get_dest(port, dest);
+
+	state = port_get_state(dest_port);
+	if(state != PORT_STATE_CONN)
+	{
+		rcu_read_unlock();
+		return ret;
+	}
+
+	/* the list may wait for room, so dest_port is pinned instead of holding up grace periods */
+	port_get2(dest_port);
+	rcu_read_unlock();
+
+	sk_buffer_t *sk_buffer = NULL;
+	if(dest_port->conflate_cb)
+	{
+		/* each message may take the place of a queued one of its key, so they are queued one by one */
+		ret = 0;
+		while(!list_empty(list))
+		{
+			sk_buffer = list_first_entry(list, sk_buffer_t, node);
+			list_del_init(&sk_buffer->node);
+
+			int ret2 = port_try_push2(dest_port, sk_buffer);
+			if(ret2 == 0)
+				ret2 = port_wait_push2(dest_port, sk_buffer);
+			if(ret2 != 1)
+			{
+				list_add(&sk_buffer->node, list);
+				break;
+			}
+			ret++;
+		}
+
+		port_put2(dest_port);
+
+		return ret;
+	}
+
+	list_for_each_entry(sk_buffer, list, node)
+		trace_stamp(sk_buffer, TRACE_ENQUEUE);
+
+	sk_buffer = list_first_entry(list, sk_buffer_t, node);
+	ret = prio_queue_push_list(&dest_port->queue, list, PORT_PRIORITY_LANE(sk_buffer->priority));
+	if(ret > 0)
+	{
+		__atomic_fetch_add(&dest_port->stat.push, ret, __ATOMIC_RELAXED);
+		port_notify(dest_port);
+	}
+
+	port_put2(dest_port);
+
+	return ret;
+}
+
+/* runs the broadcast callbacks of the len ports pinned in member outside rcu_read_lock, then unpins them */
+static void port_call2(port_t **member, int len, sk_buffer_t *sk_buffer)
+{
+	for(int i = 0; i < len; i++)
+	{
+		member[i]->cb(member[i], sk_buffer);
+		port_put2(member[i]);
+	}
+}
+
+int port_broadcast(port_t *port, sk_buffer_t *sk_buffer)
+{
+	if(!port || !sk_buffer)
+		return -1;
+	
+	char state = port_get_state(port);
 	if(state != PORT_STATE_CONN)
 		return -1;
 	
-	pthread_mutex_lock(&port_list_mutex);
+	port_t *stack[PORT_MEMBER_STACK];
+	port_t **member = stack;
+	int len = 0;
+
+	rcu_read_lock();
 	
-	port_t *link = NULL;
-	list_for_each_entry(link, &port_list, node)
+	port_set_t *set = rcu_dereference(port_set);
+	if(set && set->len > PORT_MEMBER_STACK)
+		member = (port_t **)malloc(set->len * sizeof(port_t *));
+	for(int i = 0; set && member && i < set->len; i++)
 	{
+		port_t *link = set->port[i];
+
 		state = port_get_state(link);
 		if(state != PORT_STATE_CONN)
 			continue;
 		
 		if(port->id != link->id && link->cb)
-			link->cb(link, sk_buffer);
+		{
+			port_get2(link);
+			member[len++] = link;
+		}
+	}
+	
+	rcu_read_unlock();
+
+	if(!member)
+		return -1;
+
+	port_call2(member, len, sk_buffer);
+	if(member != stack)
+		free(member);
+
+	return 1;
+}
+
+int port_join(port_t *port, unsigned int group)
+{
+	if(!port)
+		return -1;
+
+	pthread_mutex_lock(&port_list_mutex);
+	int ret = port_group_update(PORT_GROUP_INDEX(group), port, group, 1);
+	pthread_mutex_unlock(&port_list_mutex);
+
+	return ret;
+}
+
+int port_leave(port_t *port, unsigned int group)
+{
+	if(!port)
+		return -1;
+
+	pthread_mutex_lock(&port_list_mutex);
+	int ret = port_group_update(PORT_GROUP_INDEX(group), port, group, -1);
+	pthread_mutex_unlock(&port_list_mutex);
+
+	return ret;
+}
+
+int port_join_range(port_t *port, unsigned int first, unsigned int last)
+{
+	if(!port || first > last)
+		return -1;
+
+	pthread_mutex_lock(&port_list_mutex);
+	int ret = port_range_update(port, first, last, 1);
+	pthread_mutex_unlock(&port_list_mutex);
+
+	return ret;
+}
+
+int port_leave_range(port_t *port, unsigned int first, unsigned int last)
+{
+	if(!port || first > last)
+		return -1;
+
+	pthread_mutex_lock(&port_list_mutex);
+	int ret = port_range_update(port, first, last, -1);
+	pthread_mutex_unlock(&port_list_mutex);
+
+	return ret;
+}
+
+/* whether link already got group from the bucket */
+static char port_is_member(port_group_t *set, port_t *link, unsigned int group)
+{
+	for(int i = 0; set && i < set->len; i++)
+		if(set->member[i].group == group && set->member[i].port == link)
+			return 1;
+
+	return 0;
+}
+
+/* the slice holding group, NULL when no range covers it. Called under rcu_read_lock */
+static port_slice_t *port_slice_get(port_slices_t *slices, unsigned int group)
+{
+	int low = 0, high = slices ? slices->len - 1 : -1;
+	while(low <= high)
+	{
+		int mid = (low + high) / 2;
+		port_slice_t *slice = slices->slice[mid];
+		if(group < slice->first)
+			high = mid - 1;
+		else if(group > slice->last)
+			low = mid + 1;
+		else
+			return slice;
+	}
+
+	return NULL;
+}
+
+int port_multicast(port_t *port, unsigned int group, sk_buffer_t *sk_buffer)
+{
+	if(!port || !sk_buffer)
+		return -1;
+	
+	char state = port_get_state(port);
+	if(state != PORT_STATE_CONN)
+		return -1;
+	
+	port_t *stack[PORT_MEMBER_STACK];
+	port_t **member = stack;
+	int len = 0;
+
+	rcu_read_lock();
+	
+	port_group_t *set = rcu_dereference(port_group[PORT_GROUP_INDEX(group)]);
+	port_slice_t *slice = port_slice_get(rcu_dereference(port_slices), group);
+	int max = (set ? set->len : 0) + (slice ? slice->len : 0);
+	if(max > PORT_MEMBER_STACK)
+		member = (port_t **)malloc(max * sizeof(port_t *));
+	for(int i = 0; set && member && i < set->len; i++)
+	{
+		port_t *link = set->member[i].port;
+		if(set->member[i].group != group || link == port)
+			continue;
+
+		state = port_get_state(link);
+		if(state != PORT_STATE_CONN)
+			continue;
+		
+		if(link->cb)
+		{
+			port_get2(link);
+			member[len++] = link;
+		}
+	}
+
+	for(int i = 0; slice && member && i < slice->len; i++)
+	{
+		port_t *link = slice->port[i];
+		if(link == port || port_is_member(set, link, group))
+			continue;
+
+		state = port_get_state(link);
+		if(state != PORT_STATE_CONN)
+			continue;
+		
+		if(link->cb)
+		{
+			port_get2(link);
+			member[len++] = link;
+		}
 	}
 	
+	rcu_read_unlock();
+
+	if(!member)
+		return -1;
+
+	port_call2(member, len, sk_buffer);
+	if(member != stack)
+		free(member);
+
+	return 1;
+}
+
+int port_get_group(port_t *port, unsigned int *group, int len)
+{
+	if((!group && len > 0) || len < 0)
+		return -1;
+
+	int num = 0;
+
+	pthread_mutex_lock(&port_list_mutex);
+
+	for(int i = 0; i < PORT_GROUP_LEN; i++)
+	{
+		port_group_t *set = port_group[i];
+		for(int j = 0; set && j < set->len; j++)
+		{
+			if(set->member[j].port == port)
+				continue;
+
+			char is_dup = 0;
+			for(int k = 0; k < j; k++)
+			{
+				if(set->member[k].group == set->member[j].group && set->member[k].port != port)
+				{
+					is_dup = 1;
+					break;
+				}
+			}
+			if(is_dup)
+				continue;
+
+			if(num < len)
+				group[num] = set->member[j].group;
+			num++;
+		}
+	}
+
+	pthread_mutex_unlock(&port_list_mutex);
+
+	return num;
+}
+
+int port_get_range(port_t *port, unsigned int *range, int len)
+{
+	if((!range && len > 0) || len < 0)
+		return -1;
+
+	int num = 0;
+
+	pthread_mutex_lock(&port_list_mutex);
+
+	port_range_t *range2 = port_range;
+	for(int i = 0; range2 && i < range2->len; i++)
+	{
+		port_span_t *span = &range2->span[i];
+		if(span->port == port)
+			continue;
+
+		char is_dup = 0;
+		for(int j = 0; j < i; j++)
+		{
+			if(range2->span[j].first == span->first && range2->span[j].last == span->last && range2->span[j].port != port)
+			{
+				is_dup = 1;
+				break;
+			}
+		}
+		if(is_dup)
+			continue;
+
+		if(num < len)
+		{
+			range[num * 2] = span->first;
+			range[num * 2 + 1] = span->last;
+		}
+		num++;
+	}
+
 	pthread_mutex_unlock(&port_list_mutex);
 
+	return num;
+}
+
+unsigned int port_get_group_gen(void)
+{
+	return __atomic_load_n(&port_group_gen, __ATOMIC_RELAXED);
+}
+
+int port_set_spin(port_t *port, int max)
+{
+	if(!port || max < 0)
+		return -1;
+
+	if(sysconf(_SC_NPROCESSORS_ONLN) < 2)
+		max = 0;
+
+	port->spin_max = max;
+	port->spin = max;
+
 	return 1;
 }
 
-sk_buffer_t *port_recv(port_t *port)
+static long long port_get_us(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* the polling limit of the calling thread, real-time policies keep it short, see port_set_spin */
+static int port_spin_max2(port_t *port)
+{
+	/* threads are created with their scheduling and keep it, look it up once */
+	static __thread int policy = -1;
+	if(policy < 0)
+	{
+		struct sched_param param;
+		if(pthread_getschedparam(pthread_self(), &policy, &param) != 0)
+			policy = SCHED_OTHER;
+	}
+
+	if((policy == SCHED_FIFO || policy == SCHED_RR) && port->spin_max > PORT_SPIN_RT_MAX)
+		return PORT_SPIN_RT_MAX;
+
+	return port->spin_max;
+}
+
+/*
+ * polls for up to port->spin us, yielding so a sender on the same cpu can run. When it runs out
+ * the blocking wait is timed, a wait shorter than the limit means polling a bit longer would have
+ * caught the message, otherwise the budget is halved so idle ports stop burning cpu.
+ */
+static struct list_head *port_spin_pop(port_t *port)
+{
+	int max = port_spin_max2(port);
+	if(port->spin > max)
+		port->spin = max;
+
+	long long start = port_get_us();
+	long long now = start;
+	while(now - start <= port->spin)
+	{
+		if(__atomic_load_n(&port->queue.len, __ATOMIC_RELAXED) > 0)
+		{
+			struct list_head *node = prio_queue_try_pop(&port->queue);
+			if(node)
+				return node;
+		}
+
+		sched_yield();
+		now = port_get_us();
+	}
+
+	struct list_head *node = prio_queue_pop(&port->queue);
+
+	long long wait = port_get_us() - now;
+	if(wait < max)
+		port->spin = port->spin + wait + 1 < max ? port->spin + wait + 1 : max;
+	else
+		port->spin /= 2;
+
+	return node;
+}
+
+static sk_buffer_t *port_recv2(port_t *port, char is_block)
 {
 	if(!port)
 		return NULL;
 	
-	struct list_head *node = queue_pop(&port->queue);
+	struct list_head *node = NULL;
+	if(!is_block)
+		node = prio_queue_try_pop(&port->queue);
+	else if(port->spin_max > 0 && !__atomic_load_n(&port->queue.is_close, __ATOMIC_RELAXED))
+		node = port_spin_pop(port);
+	else
+		node = prio_queue_pop(&port->queue);
 	if(!node)
 		return NULL;
 	
 	sk_buffer_t *sk_buffer = container_of(node, sk_buffer_t, node);
 	if(!sk_buffer)
 		return NULL;
+
+	/* forget the message before its node is reused, a later one of the key is queued anew */
+	unsigned long long key = port->conflate_cb ? port->conflate_cb(port, sk_buffer) : 0;
+	if(key)
+	{
+		pthread_mutex_lock(&port->conflate_mutex);
+		port_conflate_t *conflate = port_conflate_get(port, key);
+		if(conflate && conflate->sk_buffer == sk_buffer)
+		{
+			conflate->sk_buffer = NULL;
+			sk_buffer_put(sk_buffer);
+		}
+		pthread_mutex_unlock(&port->conflate_mutex);
+	}
 	
 	return sk_buffer;
 }
+
+sk_buffer_t *port_recv(port_t *port)
+{
+	return port_recv2(port, 1);
+}
+
+sk_buffer_t *port_try_recv(port_t *port)
+{
+	return port_recv2(port, 0);
+}
+
+int port_close(port_t *port, int drain)
+{
+	if(!port)
+		return -1;
+
+	int ret = prio_queue_close(&port->queue, drain);
+	port_notify(port);
+
+	return ret;
+}
+
+int port_open(port_t *port)
+{
+	if(!port)
+		return -1;
+
+	return prio_queue_open(&port->queue);
+}
+
+int port_get_fd(port_t *port)
+{
+	if(!port)
+		return -1;
+
+	if(port->fd >= 0)
+		return port->fd;
+
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(fd < 0)
+	{
+		printf("eventfd failed\n");
+		return -1;
+	}
+
+	__atomic_store_n(&port->fd, fd, __ATOMIC_RELEASE);
+
+	/* messages queued before the eventfd existed are pending already */
+	port_notify(port);
+
+	return fd;
+}
@@ -9,6 +9,8 @@ extern "C"
 #endif
 
 #include "queue.h"
+#include "prio_queue.h"
+#include "hashtable.h"
 #include "sk_buffer.h"
 
 #define PORT_NUM(x ,y, z) ((((x) & 0x1) << 15) | (((y) & 0xFF) << 7) | (((z) & 0x7F)))
@@ -16,6 +18,29 @@ extern "C"
 #define PORT_Y(id) (((id) & 0x7F80) >> 7)
 #define PORT_Z(id) ((id) & 0x007F)
 #define PORT_ROUTE(id) (((id) & 0xFF80) + 1)
+#define PORT_TABLE_LEN 65536
+#define PORT_QUEUE_MAX 4096
+#define PORT_QUEUE_GUARD 16
+#define PORT_PRIORITY_LANE(priority) ((((priority) & 0xFF) * PRIO_QUEUE_LANE) >> 8)
+#define PORT_OPTION_PRIORITY(option) ((option) & 0xFF)
+#define PORT_FIB_LEN 512
+#define PORT_FIB_INDEX(id) ((id) >> 7)
+#define PORT_FIB_NEXT(route) ((route) & 0xFFFF)
+#define PORT_FIB_DIRECT 0x10000
+#define PORT_FIB_LOCAL 0x20000
+#define PORT_GROUP_LEN 256
+#define PORT_GROUP_INDEX(group) ((group) & (PORT_GROUP_LEN - 1))
+#define PORT_CONFLATE_LEN 256
+/* us a thread under SCHED_FIFO or SCHED_RR polls at most, lower priority threads on its cpu get nothing meanwhile */
+#define PORT_SPIN_RT_MAX 50
+/* members of one broadcast pinned on the stack before their callbacks run, more take an allocation */
+#define PORT_MEMBER_STACK 16
+/* option bit of a message whose hash field holds its hash, a message without it is never checked */
+#define PORT_OPTION_HASH 0x800
+/* the checksum algorithm of a hashed message, see checksum.h */
+#define PORT_OPTION_CHECKSUM_SHIFT 12
+#define PORT_OPTION_CHECKSUM_MASK 0xF000
+#define PORT_OPTION_CHECKSUM(option) (((option) & PORT_OPTION_CHECKSUM_MASK) >> PORT_OPTION_CHECKSUM_SHIFT)
 
 enum
 {
@@ -42,6 +67,14 @@ enum
     PORT_BROADCAST = 0xFFFF,	
 };
 
+/* which hops of a port hash and check the messages passing it */
+enum
+{
+	PORT_INTEGRITY_NONE = 0,
+	PORT_INTEGRITY_EDGE,
+	PORT_INTEGRITY_HOP,
+};
+
 enum
 {
 	PORT_STATE_UNKOWN = 0,
@@ -55,12 +88,50 @@ typedef struct port port_t;
 
 typedef int (*broadcast_callback_t)(port_t *port, sk_buffer_t *sk_buffer);
 
+/* returns the conflation key of sk_buffer, 0 when it is never replaced */
+typedef unsigned long long (*conflate_callback_t)(port_t *port, sk_buffer_t *sk_buffer);
+
+/* the newest queued message of one conflation key, holds a reference on it */
+typedef struct
+{
+	unsigned long long key;
+	sk_buffer_t *sk_buffer;
+	struct hlist_node node;
+} port_conflate_t;
+
+/* where a port pushed back on its senders */
+typedef struct
+{
+	unsigned long long push;
+	unsigned long long block;
+	unsigned long long would_block;
+	unsigned long long conflate;
+} port_stat_t;
+
+/* one entry per route prefix (PORT_X and PORT_Y of the destination), rebuilt by the registry writers */
+typedef struct
+{
+	unsigned int route;
+	port_t *port;
+} port_fib_t;
+
 struct port
 {
 	unsigned short id;
 	char state;
-	queue_t queue;
+	prio_queue_t queue;
+	port_fib_t *fib;
+	unsigned short *route;
+	port_stat_t stat;
 	broadcast_callback_t cb;
+	conflate_callback_t conflate_cb;
+	pthread_mutex_t conflate_mutex;
+	struct hlist_head conflate[PORT_CONFLATE_LEN];
+	int fd;
+	int spin_max;
+	int spin;
+	char integrity;
+	int ref;
 	void *p;
 	struct list_head node;
 };
@@ -73,17 +144,10 @@ port_t *port_create(unsigned short id);
 
 int port_destroy(port_t *port);
 
+/* lock-free lookup, the result stays valid inside rcu_read_lock/rcu_read_unlock */
 port_t *port_get_by_id(unsigned short id);
 
-static inline int port_set_state(port_t *port, char state)
-{
-	if(!port)
-		return -1;
-	
-	port->state = state;
-	
-	return 1;
-}
+int port_set_state(port_t *port, char state);
 
 static inline char port_get_state(port_t *port)
 {
@@ -93,6 +157,20 @@ static inline char port_get_state(port_t *port)
 	return port->state;
 }
 
+/*
+ * set before the port is connected. A message whose key still has a message waiting in the queue
+ * takes its place and the old one is dropped, so a reader only sees the newest of each key.
+ */
+static inline int port_set_conflate_callback(port_t *port, conflate_callback_t cb)
+{
+	if(!port)
+		return -1;
+
+	port->conflate_cb = cb;
+
+	return 1;
+}
+
 static inline int port_set_broadcast_callback(port_t *port, broadcast_callback_t cb)
 {
 	if(!port || !cb)
@@ -103,6 +181,47 @@ static inline int port_set_broadcast_callback(port_t *port, broadcast_callback_t
 	return 1;
 }
 
+static inline int port_set_queue_max(port_t *port, int max)
+{
+	if(!port || max == 0)
+		return -1;
+	
+	port->queue.max = max;
+	
+	return 1;
+}
+
+/*
+ * set before the port is connected. port_recv polls the queue for up to the current budget
+ * in us before it sleeps, the budget follows the observed gaps between messages up to max.
+ * 0 disables polling, so does a single online cpu where polling only delays the sender.
+ * A receiving thread with a real-time policy, the default of the middleware threads, polls for
+ * PORT_SPIN_RT_MAX us at most: its sched_yield only lets threads of the same priority run.
+ */
+int port_set_spin(port_t *port, int max);
+
+/*
+ * set before the port is connected, PORT_INTEGRITY_EDGE by default. With NONE the port neither hashes
+ * nor checks, with EDGE only messages entering or leaving the process through a transport are hashed
+ * and checked, once at the gateway. HOP hashes at the sender and checks wherever a message is received.
+ */
+static inline int port_set_integrity(port_t *port, char integrity)
+{
+	if(!port || integrity < PORT_INTEGRITY_NONE || integrity > PORT_INTEGRITY_HOP || port->state == PORT_STATE_CONN)
+		return -1;
+
+	port->integrity = integrity;
+
+	return 1;
+}
+
+static inline char port_get_integrity(port_t *port)
+{
+	return port->integrity;
+}
+
+int port_get_stat(port_t *port, port_stat_t *stat);
+
 static inline void port_set_p(port_t *port, void *p)
 {
     port->p = p;
@@ -115,12 +234,88 @@ static inline void *port_get_p(port_t *port)
 
 unsigned short port_get_next_jump(unsigned short current, unsigned short dest);
 
+/* learned routes override port_get_next_jump for the whole route prefix of dest */
+int port_add_route(port_t *port, unsigned short dest, unsigned short next);
+
+int port_del_route(port_t *port, unsigned short dest);
+
+/* is_local[PORT_FIB_INDEX(id)] is set for every route prefix that has a port in this process */
+int port_get_local(char *is_local);
+
+static inline unsigned short port_get_next(port_t *port, unsigned short dest)
+{
+	if(dest == PORT_UNKOWN || dest == PORT_BROADCAST)
+		return PORT_UNKOWN;
+
+	unsigned int route = __atomic_load_n(&port->fib[PORT_FIB_INDEX(dest)].route, __ATOMIC_RELAXED);
+	if(route & PORT_FIB_DIRECT)
+		return dest;
+
+	return PORT_FIB_NEXT(route);
+}
+
+/*
+ * queues sk_buffer on the lane of sk_buffer->priority, returns 0 when is_block is 0 and that lane is full.
+ * Waiting is only allowed outside rcu_read_lock, on a port owned by the caller or handed to a broadcast callback.
+ */
+int port_push(port_t *port, sk_buffer_t *sk_buffer, char is_block);
+
 int port_send(port_t *port, unsigned short dest, sk_buffer_t *sk_buffer);
 
+/* returns 0 instead of waiting when the next hop queue is full */
+int port_try_send(port_t *port, unsigned short dest, sk_buffer_t *sk_buffer);
+
+/*
+ * queues every sk_buffer linked through node in list towards dest with one lock and one wakeup,
+ * they all go to the lane of the first one. A conflating dest takes them one by one like port_send.
+ * Returns the number queued, the list is emptied then.
+ */
+int port_send_list(port_t *port, unsigned short dest, struct list_head *list);
+
+/* broadcast callbacks run outside rcu_read_lock, the port they get stays valid until they return */
 int port_broadcast(port_t *port, sk_buffer_t *sk_buffer);
 
+/* joins are counted, a port stays in group until it has left as often as it joined */
+int port_join(port_t *port, unsigned int group);
+
+int port_leave(port_t *port, unsigned int group);
+
+/* joins every group from first to last, counted like port_join */
+int port_join_range(port_t *port, unsigned int first, unsigned int last);
+
+int port_leave_range(port_t *port, unsigned int first, unsigned int last);
+
+/* calls the broadcast callback of every connected member of group except port itself, once per member */
+int port_multicast(port_t *port, unsigned int group, sk_buffer_t *sk_buffer);
+
+/* fills group with up to len groups joined by ports other than port, returns the number of such groups */
+int port_get_group(port_t *port, unsigned int *group, int len);
+
+/* fills range with the first and last group of up to len ranges joined by ports other than port, returns the number of such ranges */
+int port_get_range(port_t *port, unsigned int *range, int len);
+
+/* changes whenever a port joins or leaves a group or a range */
+unsigned int port_get_group_gen(void);
+
 sk_buffer_t *port_recv(port_t *port);
 
+/* returns NULL instead of waiting when nothing is queued */
+sk_buffer_t *port_try_recv(port_t *port);
+
+/*
+ * stops the port from taking messages, port_recv hands out what is queued for drain ms and
+ * returns NULL afterwards. What is left can still be taken with port_try_recv.
+ */
+int port_close(port_t *port, int drain);
+
+int port_open(port_t *port);
+
+/*
+ * returns an eventfd that is readable while messages may be queued, created on the first call.
+ * The reader clears it by reading before it takes messages with port_try_recv.
+ */
+int port_get_fd(port_t *port);
+
 #ifdef __cplusplus
 }
 #endif
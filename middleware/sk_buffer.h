@@ -12,66 +12,237 @@ extern "C"
 #include <stdlib.h>
 #include <string.h>
 #include "list.h"
+#include "pool.h"
+#include "checksum.h"
 
+/* fits the largest header, 24 bytes with a correlation id, transports frame messages in buffers of their own */
 #define HEADROOM_SIZE 32
 #define TAILROOM_SIZE 0
 
-typedef struct
+typedef void (*sk_buffer_release_t)(void *para);
+
+/*
+ * A clone has its own data pointers and node but shares the buffer of the original,
+ * which is freed when the last reference is put. Clones are read-only.
+ * frag chains further fragments behind data..tail, they belong to the first sk_buffer
+ * and are freed with it. An external fragment references memory of the caller,
+ * is read-only as well and calls release once it is no longer used.
+ */
+typedef struct sk_buffer
 {
     char *head;
     char *data;
     char *tail;
     char *end;
+    unsigned int priority;
+    int ref;
+    struct sk_buffer *shared;
+    struct sk_buffer *frag;
+    sk_buffer_release_t release;
+    void *para;
     struct list_head node;
     char buffer[0];
 } sk_buffer_t;
 
-static inline void *posix_memalign2(size_t alignment, size_t size)
-{
-    void *p = NULL;
-
-    if(alignment < sizeof(void *))
-        alignment = sizeof(void *);
-
-    if((alignment & (alignment - 1)) != 0)
-        return NULL;
-
-    int ret = posix_memalign(&p, alignment, size);
-    if(ret != 0)
-        return NULL;
-
-    return p;
-}
-
 static inline sk_buffer_t *sk_buffer_create(int head_len, int len, int tail_len)
 {
     int len2 = head_len + len + tail_len;
-    sk_buffer_t *sk_buffer = (sk_buffer_t *)calloc(1, sizeof(sk_buffer_t) + len2);
-    // sk_buffer_t *sk_buffer = (sk_buffer_t *)posix_memalign2(64, sizeof(sk_buffer_t) + len2);
+    sk_buffer_t *sk_buffer = (sk_buffer_t *)pool_alloc(sizeof(sk_buffer_t) + len2);
     if(!sk_buffer)
         return NULL;
         
+    memset(sk_buffer, 0x00, sizeof(sk_buffer_t));
     sk_buffer->head = sk_buffer->buffer;
     sk_buffer->end = sk_buffer->buffer + len2;
     sk_buffer->data = sk_buffer->buffer + head_len;
     sk_buffer->tail = sk_buffer->buffer + len2 - tail_len;
+    sk_buffer->ref = 1;
+
+    return sk_buffer;
+}
+
+static inline sk_buffer_t *sk_buffer_get(sk_buffer_t *sk_buffer)
+{
+    if(!sk_buffer)
+        return NULL;
+
+    __atomic_add_fetch(&sk_buffer->ref, 1, __ATOMIC_RELAXED);
 
     return sk_buffer;
 }
 
+static inline int sk_buffer_put(sk_buffer_t *sk_buffer)
+{
+    if(!sk_buffer)
+        return -1;
+
+    if(__atomic_sub_fetch(&sk_buffer->ref, 1, __ATOMIC_ACQ_REL) != 0)
+        return 1;
+
+    if(sk_buffer->release)
+        sk_buffer->release(sk_buffer->para);
+
+    if(sk_buffer->shared)
+        sk_buffer_put(sk_buffer->shared);
+    else
+    {
+        sk_buffer_t *frag = sk_buffer->frag;
+        while(frag)
+        {
+            sk_buffer_t *next = frag->frag;
+            frag->frag = NULL;
+            sk_buffer_put(frag);
+            frag = next;
+        }
+    }
+
+    pool_free(sk_buffer);
+
+    return 1;
+}
+
+static inline sk_buffer_t *sk_buffer_clone(sk_buffer_t *sk_buffer)
+{
+    if(!sk_buffer)
+        return NULL;
+
+    sk_buffer_t *sk_buffer2 = (sk_buffer_t *)pool_alloc(sizeof(sk_buffer_t));
+    if(!sk_buffer2)
+        return NULL;
+
+    memset(sk_buffer2, 0x00, sizeof(sk_buffer_t));
+    sk_buffer2->head = sk_buffer->head;
+    sk_buffer2->data = sk_buffer->data;
+    sk_buffer2->tail = sk_buffer->tail;
+    sk_buffer2->end = sk_buffer->end;
+    sk_buffer2->priority = sk_buffer->priority;
+    sk_buffer2->frag = sk_buffer->frag;
+    sk_buffer2->ref = 1;
+    sk_buffer2->shared = sk_buffer_get(sk_buffer->shared ? sk_buffer->shared : sk_buffer);
+
+    return sk_buffer2;
+}
+
 static inline int sk_buffer_destroy(sk_buffer_t *sk_buffer)
 {
+    return sk_buffer_put(sk_buffer);
+}
+
+static inline sk_buffer_t *sk_buffer_create_ext(char *buffer, int len, sk_buffer_release_t release, void *para)
+{
+    if(!buffer || len <= 0)
+        return NULL;
+
+    sk_buffer_t *sk_buffer = (sk_buffer_t *)pool_alloc(sizeof(sk_buffer_t));
     if(!sk_buffer)
+        return NULL;
+
+    memset(sk_buffer, 0x00, sizeof(sk_buffer_t));
+    sk_buffer->head = buffer;
+    sk_buffer->data = buffer;
+    sk_buffer->tail = buffer + len;
+    sk_buffer->end = buffer + len;
+    sk_buffer->ref = 1;
+    sk_buffer->release = release;
+    sk_buffer->para = para;
+
+    return sk_buffer;
+}
+
+static inline int sk_buffer_add_frag(sk_buffer_t *sk_buffer, sk_buffer_t *frag)
+{
+    if(!sk_buffer || !frag || sk_buffer->shared)
         return -1;
 
-    free(sk_buffer);
+    while(sk_buffer->frag)
+        sk_buffer = sk_buffer->frag;
+    sk_buffer->frag = frag;
 
     return 1;
 }
 
+static inline int sk_buffer_len(sk_buffer_t *sk_buffer)
+{
+    int len = 0;
+
+    for(; sk_buffer; sk_buffer = sk_buffer->frag)
+        len += sk_buffer->tail - sk_buffer->data;
+
+    return len;
+}
+
+/* copies len bytes starting at offset of the whole chain into buffer, returns the number copied */
+static inline int sk_buffer_read(sk_buffer_t *sk_buffer, int offset, char *buffer, int len)
+{
+    int len2 = 0;
+
+    for(; sk_buffer && len2 < len; sk_buffer = sk_buffer->frag)
+    {
+        int frag_len = sk_buffer->tail - sk_buffer->data;
+        if(offset >= frag_len)
+        {
+            offset -= frag_len;
+            continue;
+        }
+
+        int copy_len = frag_len - offset;
+        if(copy_len > len - len2)
+            copy_len = len - len2;
+
+        memcpy(buffer + len2, sk_buffer->data + offset, copy_len);
+        len2 += copy_len;
+        offset = 0;
+    }
+
+    return len2;
+}
+
+/* returns a reference to a single contiguous sk_buffer holding the whole chain, sk_buffer itself if it has no fragments */
+static inline sk_buffer_t *sk_buffer_linearize(sk_buffer_t *sk_buffer)
+{
+    if(!sk_buffer)
+        return NULL;
+
+    if(!sk_buffer->frag)
+        return sk_buffer_get(sk_buffer);
+
+    int len = sk_buffer_len(sk_buffer);
+    sk_buffer_t *sk_buffer2 = sk_buffer_create(HEADROOM_SIZE, len, TAILROOM_SIZE);
+    if(!sk_buffer2)
+        return NULL;
+
+    sk_buffer_read(sk_buffer, 0, sk_buffer2->data, len);
+    sk_buffer2->priority = sk_buffer->priority;
+
+    return sk_buffer2;
+}
+
+/* hashes the whole chain with algorithm except its last skip bytes, which have to lie in the last fragment */
+static inline unsigned int sk_buffer_hash_skip(sk_buffer_t *sk_buffer, int skip, int algorithm)
+{
+    checksum_ops_t *ops = checksum_get_ops(algorithm);
+    if(!ops)
+        return 0;
+
+    if(!sk_buffer->frag)
+        return ops->hash(sk_buffer->data, sk_buffer->tail - sk_buffer->data - skip);
+
+    checksum_state_t state;
+    ops->reset(&state);
+    for(; sk_buffer; sk_buffer = sk_buffer->frag)
+        ops->update(&state, sk_buffer->data, sk_buffer->tail - sk_buffer->data - (sk_buffer->frag ? 0 : skip));
+
+    return ops->digest(&state);
+}
+
+static inline unsigned int sk_buffer_hash(sk_buffer_t *sk_buffer, int algorithm)
+{
+    return sk_buffer_hash_skip(sk_buffer, 0, algorithm);
+}
+
 static inline int sk_buffer_data_copy(sk_buffer_t *sk_buffer, const char *buffer, int buffer_len)
 {
-    if(!sk_buffer || !buffer || buffer_len == 0)
+    if(!sk_buffer || !buffer || buffer_len == 0 || sk_buffer->head != sk_buffer->buffer)
         return -1;
 
     if(sk_buffer->data + buffer_len > sk_buffer->tail)
@@ -87,7 +258,7 @@ static inline int sk_buffer_data_copy(sk_buffer_t *sk_buffer, const char *buffer
 
 static inline int sk_buffer_push_copy(sk_buffer_t *sk_buffer, const char *buffer, int buffer_len)
 {
-    if(!sk_buffer || !buffer || buffer_len == 0)
+    if(!sk_buffer || !buffer || buffer_len == 0 || sk_buffer->head != sk_buffer->buffer)
         return -1;
 
     if(sk_buffer->data - sk_buffer->head < buffer_len)
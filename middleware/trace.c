@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+static trace_stat_t trace_stat;
+
+static const char *trace_name[TRACE_NUM] = {"total", "enqueue", "gateway", "middleware", "recv", "ops", "dispatch"};
+
+int trace_append(sk_buffer_t *sk_buffer)
+{
+	if(!sk_buffer)
+		return -1;
+
+	sk_buffer_t *trace = sk_buffer_create(0, TRACE_SIZE, 0);
+	if(!trace)
+		return -1;
+
+	memset(trace->data, 0x00, TRACE_SIZE);
+	unsigned long long ns = trace_get_ns();
+	memcpy(trace->data + TRACE_SEND * 8, &ns, 8);
+
+	if(sk_buffer_add_frag(sk_buffer, trace) != 1)
+	{
+		sk_buffer_destroy(trace);
+		return -1;
+	}
+
+	return 1;
+}
+
+static void trace_add(int stage, unsigned long long ns)
+{
+	unsigned long long us = ns / 1000;
+	int i = us ? 64 - __builtin_clzll(us) : 0;
+	if(i >= TRACE_BUCKET)
+		i = TRACE_BUCKET - 1;
+
+	__atomic_fetch_add(&trace_stat.count[stage], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&trace_stat.sum[stage], ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&trace_stat.bucket[stage][i], 1, __ATOMIC_RELAXED);
+
+	unsigned long long max = __atomic_load_n(&trace_stat.max[stage], __ATOMIC_RELAXED);
+	while(ns > max && !__atomic_compare_exchange_n(&trace_stat.max[stage], &max, ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+int trace_record(sk_buffer_t *sk_buffer)
+{
+	if(!sk_buffer)
+		return -1;
+
+	char *trace = trace_get(sk_buffer);
+	if(!trace)
+		return 0;
+
+	unsigned long long ns[TRACE_NUM];
+	memcpy(ns, trace, TRACE_SIZE);
+	if(!ns[TRACE_SEND])
+		return 0;
+
+	/* a stage earlier than the one before came from another clock and is skipped */
+	unsigned long long prev = ns[TRACE_SEND];
+	for(int i = TRACE_SEND + 1; i < TRACE_NUM; i++)
+	{
+		if(!ns[i] || ns[i] < prev)
+			continue;
+
+		trace_add(i, ns[i] - prev);
+		prev = ns[i];
+	}
+
+	if(ns[TRACE_DISPATCH] >= ns[TRACE_SEND])
+		trace_add(TRACE_SEND, ns[TRACE_DISPATCH] - ns[TRACE_SEND]);
+
+	return 1;
+}
+
+int trace_get_stat(trace_stat_t *stat)
+{
+	if(!stat)
+		return -1;
+
+	for(int i = 0; i < TRACE_NUM; i++)
+	{
+		stat->count[i] = __atomic_load_n(&trace_stat.count[i], __ATOMIC_RELAXED);
+		stat->sum[i] = __atomic_load_n(&trace_stat.sum[i], __ATOMIC_RELAXED);
+		stat->max[i] = __atomic_load_n(&trace_stat.max[i], __ATOMIC_RELAXED);
+		for(int j = 0; j < TRACE_BUCKET; j++)
+			stat->bucket[i][j] = __atomic_load_n(&trace_stat.bucket[i][j], __ATOMIC_RELAXED);
+	}
+
+	return 1;
+}
+
+int trace_reset_stat(void)
+{
+	for(int i = 0; i < TRACE_NUM; i++)
+	{
+		__atomic_store_n(&trace_stat.count[i], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&trace_stat.sum[i], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&trace_stat.max[i], 0, __ATOMIC_RELAXED);
+		for(int j = 0; j < TRACE_BUCKET; j++)
+			__atomic_store_n(&trace_stat.bucket[i][j], 0, __ATOMIC_RELAXED);
+	}
+
+	return 1;
+}
+
+int trace_print(void)
+{
+	trace_stat_t stat;
+	trace_get_stat(&stat);
+
+	printf("stage,      count,     mean us,    max us,  histogram (below us: count)\n");
+	for(int i = 0; i < TRACE_NUM; i++)
+	{
+		if(stat.count[i] == 0)
+			continue;
+
+		printf("%-10s, %9llu, %10.3f, %10.3f, ", trace_name[i], stat.count[i], \
+			(double)stat.sum[i] / stat.count[i] / 1000, (double)stat.max[i] / 1000);
+		for(int j = 0; j < TRACE_BUCKET; j++)
+		{
+			if(stat.bucket[i][j] == 0)
+				continue;
+
+			if(j == TRACE_BUCKET - 1)
+				printf(" inf:%llu", stat.bucket[i][j]);
+			else
+				printf(" %llu:%llu", 1ULL << j, stat.bucket[i][j]);
+		}
+		printf("\n");
+	}
+
+	return 1;
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <string.h>
+#include <time.h>
+#include "sk_buffer.h"
+#include "port.h"
+
+/*
+ * option bit of a message carrying a trace, the TRACE_SIZE bytes behind its payload hold
+ * one CLOCK_MONOTONIC timestamp in ns per stage, 0 for a stage it did not pass.
+ * The trace is left out of the hash, so every hop stamps it in place.
+ */
+#define TRACE_OPTION 0x400
+#define TRACE_BUCKET 24
+
+enum
+{
+	TRACE_SEND = 0,
+	TRACE_ENQUEUE,
+	TRACE_GATEWAY,
+	TRACE_MIDDLEWARE,
+	TRACE_RECV,
+	TRACE_OPS,
+	TRACE_DISPATCH,
+	TRACE_NUM,
+};
+
+#define TRACE_SIZE (TRACE_NUM * 8)
+
+/*
+ * per stage the time since the previous stage the message passed, TRACE_SEND holds the time from send to dispatch.
+ * bucket[i] counts times below 2^i us and at least 2^(i-1) us. Timestamps of different hosts are not comparable.
+ */
+typedef struct
+{
+	unsigned long long count[TRACE_NUM];
+	unsigned long long sum[TRACE_NUM];
+	unsigned long long max[TRACE_NUM];
+	unsigned long long bucket[TRACE_NUM][TRACE_BUCKET];
+} trace_stat_t;
+
+static inline unsigned long long trace_get_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* the trace of a message whose data starts at the hash, NULL when it has none */
+static inline char *trace_get(sk_buffer_t *sk_buffer)
+{
+	if(sk_buffer->tail - sk_buffer->data < 12 || !(*(unsigned int *)(sk_buffer->data + 8) & TRACE_OPTION))
+		return NULL;
+
+	while(sk_buffer->frag)
+		sk_buffer = sk_buffer->frag;
+	if(sk_buffer->tail - sk_buffer->data < TRACE_SIZE)
+		return NULL;
+
+	return sk_buffer->tail - TRACE_SIZE;
+}
+
+/* records the first time a traced message reaches stage */
+static inline void trace_stamp(sk_buffer_t *sk_buffer, int stage)
+{
+	char *trace = trace_get(sk_buffer);
+	if(!trace)
+		return;
+
+	unsigned long long ns = 0;
+	memcpy(&ns, trace + stage * 8, 8);
+	if(ns)
+		return;
+
+	ns = trace_get_ns();
+	memcpy(trace + stage * 8, &ns, 8);
+}
+
+/* hash of a message whose data starts at the source, without its trace, by the checksum its option names */
+static inline unsigned int trace_hash(sk_buffer_t *sk_buffer)
+{
+	unsigned int option = sk_buffer->tail - sk_buffer->data >= 8 ? *(unsigned int *)(sk_buffer->data + 4) : 0;
+
+	return sk_buffer_hash_skip(sk_buffer, (option & TRACE_OPTION) ? TRACE_SIZE : 0, PORT_OPTION_CHECKSUM(option));
+}
+
+/* appends an empty trace to a message before its header is pushed, stamped with TRACE_SEND */
+int trace_append(sk_buffer_t *sk_buffer);
+
+/* adds the trace of a dispatched message, data at the hash, to the statistics of this process */
+int trace_record(sk_buffer_t *sk_buffer);
+
+int trace_get_stat(trace_stat_t *stat);
+
+int trace_reset_stat(void);
+
+/* prints a latency histogram per stage */
+int trace_print(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
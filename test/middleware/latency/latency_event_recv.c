@@ -38,18 +38,47 @@ static int event_callback(event_thread_t *event_thread, void *para, unsigned sho
 	double end = get_microsecond();
 	*((float *)(buffer + 12)) = (float)(end - start);
 
-	event_send(event_thread, PORT_MPU_TEST_APP0, 1234, buffer, buffer_len);
+	if(event == 1236)
+		event_reply(event_thread, buffer, buffer_len);
+	else
+		event_send(event_thread, PORT_MPU_TEST_APP0, 1234, buffer, buffer_len);
 
 	return 1;
 }
 
 int main(int argc, char *argv[])
 {
-	gateway_t *gateway = gateway_create(PORT_MPU_TEST2_ROUTE, 1);
+	// "nng" and "iox2" pick the transport of the gateway when built in, the first one built in otherwise
+	char type = MIDDLEWARE_TYPE_UNKOWN + 1;
+	for(int k = 1; k < argc; k++)
+	{
+		#if defined(MIDDLEWARE_NNG)
+		if(strcmp(argv[k], "nng") == 0)
+			type = MIDDLEWARE_TYPE_NNG;
+		#endif
+		#if defined(MIDDLEWARE_IOX2)
+		if(strcmp(argv[k], "iox2") == 0)
+			type = MIDDLEWARE_TYPE_IOX2;
+		#endif
+	}
+
+	gateway_t *gateway = gateway_create(PORT_MPU_TEST2_ROUTE, type);
 	gateway_start(gateway);
 	
 	event_thread_t *event_thread = event_thread_create(PORT_MPU_TEST2_APP0, 10);
 	event_thread_attach_event(event_thread, 1235, event_callback, NULL);
+	// requests of latency_event_send "call" are answered with event_reply
+	event_thread_attach_event(event_thread, 1236, event_callback, NULL);
+
+	// "spin" polls the queue for up to 1000us before sleeping, "trace" traces the replies for latency_event_send
+	for(int k = 1; k < argc; k++)
+	{
+		if(strcmp(argv[k], "spin") == 0)
+			event_thread_set_spin(event_thread, 1000);
+		else if(strcmp(argv[k], "trace") == 0)
+			event_thread_set_trace(event_thread, 1);
+	}
+
 	event_thread_start(event_thread);
 
 	while(1)
@@ -10,6 +10,7 @@
 #include "list.h"
 #include "gateway.h"
 #include "event.h"
+#include "trace.h"
 
 // test protocol
 // length + send_count + recv_count + bounce_time
@@ -58,11 +59,8 @@ static double get_microsecond(void)
 	return (double)time.tv_sec * 1000 + (double)time.tv_nsec / 1000000;
 }
 
-static int event_callback(event_thread_t *event_thread, void *para, unsigned short source_id, unsigned int event, char *buffer, int buffer_len)
+static void time_add(char *buffer)
 {
-	if(!event_thread || !buffer)
-		goto exit;
-
 	double end = get_microsecond();
 
 	time_result[i].recv_count = *((unsigned int *)(buffer + 8));
@@ -70,12 +68,17 @@ static int event_callback(event_thread_t *event_thread, void *para, unsigned sho
 
 	time_node_t *time_node = (time_node_t *)calloc(1, sizeof(time_node_t));
 	if(!time_node)
-		goto exit;
+		return;
 
 	time_node->time = (end - start - bounce_time) / 2;
 	list_add_tail(&time_node->list, &time_result[i].node);
+}
+
+static int event_callback(event_thread_t *event_thread, void *para, unsigned short source_id, unsigned int event, char *buffer, int buffer_len)
+{
+	if(event_thread && buffer)
+		time_add(buffer);
 
-exit:
 	pthread_mutex_lock(&mutex);
 	start_flag = 1;
 	pthread_mutex_unlock(&mutex);
@@ -143,11 +146,39 @@ static void bubble_sort_list(struct list_head *head)
 
 int main(int argc, char *argv[])
 {
-	gateway_t *gateway = gateway_create(PORT_MPU_TEST_ROUTE, 1);
+	// "nng" and "iox2" pick the transport of the gateway when built in, the first one built in otherwise
+	char type = MIDDLEWARE_TYPE_UNKOWN + 1, is_call = 0;
+	for(int k = 1; k < argc; k++)
+	{
+		#if defined(MIDDLEWARE_NNG)
+		if(strcmp(argv[k], "nng") == 0)
+			type = MIDDLEWARE_TYPE_NNG;
+		#endif
+		#if defined(MIDDLEWARE_IOX2)
+		if(strcmp(argv[k], "iox2") == 0)
+			type = MIDDLEWARE_TYPE_IOX2;
+		#endif
+		if(strcmp(argv[k], "call") == 0)
+			is_call = 1;
+	}
+
+	gateway_t *gateway = gateway_create(PORT_MPU_TEST_ROUTE, type);
 	gateway_start(gateway);
 
 	event_thread_t *event_thread = event_thread_create(PORT_MPU_TEST_APP0, 10);
 	event_thread_attach_event(event_thread, 1234, event_callback, NULL);
+
+	// "spin" polls the queue for up to 1000us before sleeping, "trace" traces the messages,
+	// the per-hop latencies printed at the end are those of the replies of latency_event_recv "trace".
+	// "call" bounces with event_call instead of a pair of events, a lost reply counts as not received
+	for(int k = 1; k < argc; k++)
+	{
+		if(strcmp(argv[k], "spin") == 0)
+			event_thread_set_spin(event_thread, 1000);
+		else if(strcmp(argv[k], "trace") == 0)
+			event_thread_set_trace(event_thread, 1);
+	}
+
 	event_thread_start(event_thread);
 
     pthread_mutex_init(&mutex, NULL);
@@ -160,7 +191,8 @@ int main(int argc, char *argv[])
 		INIT_LIST_HEAD(&time_result[i].node);
 
 		char *buffer = (char *)calloc(byte[i], sizeof(char));
-		if(!buffer)
+		char *reply = (char *)calloc(byte[i], sizeof(char));
+		if(!buffer || !reply)
 			return -1;
 
 		for(int j = 0; j < SAMPLE_LEN; j++)
@@ -171,6 +203,14 @@ int main(int argc, char *argv[])
 			*((unsigned int *)(buffer + 4)) = time_result[i].send_count;
 
 			start = get_microsecond();
+			if(is_call)
+			{
+				int reply_len = byte[i];
+				if(event_call(event_thread, PORT_MPU_TEST2_APP0, 1236, buffer, byte[i], reply, &reply_len, 1000) == 1)
+					time_add(reply);
+				continue;
+			}
+
 			event_send(event_thread, PORT_MPU_TEST2_APP0, 1235, buffer, byte[i]);
 
 			struct timespec outtime;
@@ -218,5 +258,7 @@ int main(int argc, char *argv[])
 													time_result[i].max_time);
 	}
 
+	trace_print();
+
 	return 1;
 }
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "checksum.h"
+
+// hashes every payload size with each checksum for about RUN_TIME ms and prints the throughput in MB/s
+
+#define BYTE_LEN 8
+#define RUN_TIME 200
+
+static unsigned int byte[BYTE_LEN] = {64, 256, 1024, 4096, 16384, 65536, 262144, 1048576};
+static volatile unsigned int sink = 0;
+
+static double get_microsecond(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (double)time.tv_sec * 1000 + (double)time.tv_nsec / 1000000;
+}
+
+int main(int argc, char *argv[])
+{
+	char *buffer = (char *)malloc(byte[BYTE_LEN - 1]);
+	if(!buffer)
+		return -1;
+
+	for(unsigned int i = 0; i < byte[BYTE_LEN - 1]; i++)
+		buffer[i] = (char)rand();
+
+	checksum_ops_t *ops[CHECKSUM_NUM];
+	for(int j = 0; j < CHECKSUM_NUM; j++)
+		ops[j] = checksum_get_ops(j);
+
+	printf("default: %s\n", ops[checksum_get_default()]->name);
+	printf("bytes");
+	for(int j = 0; j < CHECKSUM_NUM; j++)
+		printf(", %14s", ops[j]->name);
+	printf("\n");
+
+	for(int i = 0; i < BYTE_LEN; i++)
+	{
+		printf("%07d", byte[i]);
+		for(int j = 0; j < CHECKSUM_NUM; j++)
+		{
+			unsigned long long count = 0;
+			double start = get_microsecond(), end = start;
+			while(end - start < RUN_TIME)
+			{
+				// check the clock every 1MB or so
+				for(unsigned int k = 0; k < 1048576 / byte[i] + 1; k++)
+					sink += ops[j]->hash(buffer, byte[i]);
+				count += 1048576 / byte[i] + 1;
+				end = get_microsecond();
+			}
+
+			printf(", %14.1f", (double)count * byte[i] / 1048576 / ((end - start) / 1000));
+		}
+		printf("\n");
+	}
+
+	free(buffer);
+
+	return 1;
+}
@@ -37,6 +37,7 @@ static int i = 0;
 static pthread_mutex_t mutex;
 static pthread_cond_t cond;
 static int start_flag = 0;
+static char is_batch = 0;
 
 static double get_microsecond(void)
 {
@@ -72,6 +73,10 @@ static int event_callback(event_thread_t *event_thread, void *para, unsigned sho
 int main(int argc, char *argv[])
 {
 	set_root_caps();
+
+	// "batch" sends every burst with one event_send_batch call
+	if(argc > 1 && strcmp(argv[1], "batch") == 0)
+		is_batch = 1;
 	
     struct sched_param param;
     param.sched_priority = 80;
@@ -102,6 +107,11 @@ int main(int argc, char *argv[])
 		if(!buffer)
 			return -1;
 
+		char *burst = (char *)calloc(burst_len, byte[i]);
+		event_batch_t *batch = (event_batch_t *)calloc(burst_len, sizeof(event_batch_t));
+		if(!burst || !batch)
+			return -1;
+
 		buffer[0] = 2;
 		event_send(event_thread, PORT_MPU_TEST2_APP0, 1235, buffer, byte[i]);
 		
@@ -114,11 +124,26 @@ int main(int argc, char *argv[])
 			for(int k = 0; k < burst_len; k++)
 			{
 				time_result[i].send_count++;
+				if(is_batch)
+				{
+					char *buffer2 = burst + k * byte[i];
+					buffer2[0] = 3;
+					*((unsigned int *)(buffer2 + 1)) = time_result[i].send_count;
+					batch[k].dest = PORT_MPU_TEST2_APP0;
+					batch[k].event = 1235;
+					batch[k].buffer = buffer2;
+					batch[k].buffer_len = byte[i];
+					continue;
+				}
+
 				buffer[0] = 3;
 				*((unsigned int *)(buffer + 1)) = time_result[i].send_count;
 				event_send(event_thread, PORT_MPU_TEST2_APP0, 1235, buffer, byte[i]);
 			}
 
+			if(is_batch)
+				event_send_batch(event_thread, batch, burst_len);
+
 			end = get_microsecond();
 
             // If the batch took less than the recovery time, sleep for the difference recovery_time_us - batch_duration.
@@ -137,6 +162,8 @@ int main(int argc, char *argv[])
 
 		if(buffer)
 			free(buffer);
+		free(burst);
+		free(batch);
 
 		pthread_mutex_lock(&mutex);
 		while(!start_flag)